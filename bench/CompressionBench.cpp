@@ -0,0 +1,177 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <enet.h>
+
+#include "Compression.h"
+
+// Reports how well each compressor does on datagrams captured from a server with --capture-samples, and what it
+// costs per datagram, so a deployment can pick one for its own traffic.
+//
+// Without --compression-dictionary a dictionary is trained from the first half of the samples and everything is
+// measured on the second half, so the dictionary is never tried on the datagrams it was made from.
+
+using Clock = std::chrono::steady_clock;
+
+// Each compressor is run over the samples until at least this long has been spent, to even out the timings.
+static constexpr auto MinRunTime = std::chrono::milliseconds(250);
+
+struct Result
+{
+	size_t Bytes = 0;
+	double CompressNanoseconds = 0.0;
+	double DecompressNanoseconds = 0.0;
+};
+
+// Compresses and decompresses every sample the way ENet would. A datagram which does not get any smaller is sent as
+// it is, and costs nothing to decompress.
+template<typename T>
+static Result Run(T& compressor, T& decompressor, const std::vector<std::vector<uint8_t>>& samples)
+{
+	Result result;
+
+	std::vector<std::vector<uint8_t>> compressed(samples.size());
+	std::vector<uint8_t> out(ENET_PROTOCOL_MAXIMUM_MTU);
+	std::vector<uint8_t> back(ENET_PROTOCOL_MAXIMUM_MTU);
+
+	// Compress everything once to check the output and find the size, then time it over and over.
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		ENetBuffer buffer;
+		buffer.data = const_cast<uint8_t*>(samples[i].data());
+		buffer.dataLength = samples[i].size();
+
+		size_t size = compressor.Compress(&buffer, 1, samples[i].size(), out.data(), samples[i].size());
+		if (size == 0 || size >= samples[i].size())
+		{
+			result.Bytes += samples[i].size();
+			continue;
+		}
+
+		size_t length = decompressor.Decompress(out.data(), size, back.data(), back.size());
+		if (length != samples[i].size() || std::memcmp(back.data(), samples[i].data(), length) != 0)
+		{
+			std::cout << "Sample " << i << " did not survive a round trip." << std::endl;
+			std::exit(1);
+		}
+
+		compressed[i].assign(out.begin(), out.begin() + size);
+		result.Bytes += size;
+	}
+
+	uint64_t passes = 0;
+	auto start = Clock::now();
+	do
+	{
+		for (const auto& sample : samples)
+		{
+			ENetBuffer buffer;
+			buffer.data = const_cast<uint8_t*>(sample.data());
+			buffer.dataLength = sample.size();
+			compressor.Compress(&buffer, 1, sample.size(), out.data(), sample.size());
+		}
+		passes++;
+	} while (Clock::now() - start < MinRunTime);
+	result.CompressNanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (passes * samples.size());
+
+	passes = 0;
+	start = Clock::now();
+	do
+	{
+		for (const auto& data : compressed)
+		{
+			if (data.empty()) { continue; }
+			decompressor.Decompress(data.data(), data.size(), back.data(), back.size());
+		}
+		passes++;
+	} while (Clock::now() - start < MinRunTime);
+	result.DecompressNanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (passes * samples.size());
+
+	return result;
+}
+
+static void Print(const std::string& name, const Result& result, size_t rawBytes, size_t count)
+{
+	std::cout << std::left << std::setw(12) << name << std::right << std::fixed
+		<< std::setw(8) << std::setprecision(3) << static_cast<double>(result.Bytes) / rawBytes
+		<< std::setw(10) << std::setprecision(1) << static_cast<double>(result.Bytes) / count
+		<< std::setw(14) << std::setprecision(0) << result.CompressNanoseconds
+		<< std::setw(16) << std::setprecision(0) << result.DecompressNanoseconds << std::endl;
+}
+
+template<typename T>
+static void Measure(const std::string& name, const std::vector<uint8_t>& dictionary, const std::vector<std::vector<uint8_t>>& samples, size_t rawBytes)
+{
+	T compressor(dictionary);
+	T decompressor(dictionary);
+	Print(name, Run(compressor, decompressor, samples), rawBytes, samples.size());
+}
+
+int main(int argc, char** argv)
+{
+	// Usage: compression_bench <samples> [--compression-dictionary <file>]
+	std::string samplesPath;
+	std::string dictionaryPath;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) == "--compression-dictionary" && i + 1 < argc)
+		{
+			dictionaryPath = argv[++i];
+		}
+		else
+		{
+			samplesPath = argv[i];
+		}
+	}
+
+	if (samplesPath.empty())
+	{
+		std::cout << "Usage: compression_bench <samples> [--compression-dictionary <file>]" << std::endl;
+		return 1;
+	}
+
+	std::vector<std::vector<uint8_t>> samples;
+	if (!Compression::LoadSamples(samplesPath, samples) || samples.empty())
+	{
+		std::cout << "Failed to load sample datagrams from " << samplesPath << "." << std::endl;
+		return 1;
+	}
+
+	std::vector<uint8_t> dictionary;
+	if (!dictionaryPath.empty())
+	{
+		if (!Compression::LoadDictionary(dictionaryPath, dictionary))
+		{
+			std::cout << "Failed to load compression dictionary " << dictionaryPath << "." << std::endl;
+			return 1;
+		}
+	}
+	else
+	{
+		std::vector<std::vector<uint8_t>> training(samples.begin(), samples.begin() + samples.size() / 2);
+		samples.erase(samples.begin(), samples.begin() + samples.size() / 2);
+		dictionary = Compression::TrainDictionary(training, Compression::DefaultDictionarySize);
+	}
+
+	size_t rawBytes = 0;
+	for (const auto& sample : samples) { rawBytes += sample.size(); }
+
+	std::cout << samples.size() << " datagrams averaging " << std::fixed << std::setprecision(1) << static_cast<double>(rawBytes) / samples.size()
+		<< " bytes, " << dictionary.size() << " byte dictionary." << std::endl;
+	std::cout << "Times are per datagram, including those sent uncompressed." << std::endl << std::endl;
+	std::cout << "compressor    ratio     bytes   compress ns   decompress ns" << std::endl;
+
+	Print("none", Result{ rawBytes, 0.0, 0.0 }, rawBytes, samples.size());
+
+	std::vector<uint8_t> empty;
+	Measure<LZCompressor>("lz", empty, samples, rawBytes);
+	Measure<RangeCompressor>("range", empty, samples, rawBytes);
+	Measure<LZCompressor>("lz+dict", dictionary, samples, rawBytes);
+	Measure<RangeCompressor>("range+dict", dictionary, samples, rawBytes);
+
+	return 0;
+}
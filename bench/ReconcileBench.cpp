@@ -0,0 +1,254 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include "SharedConfig.h"
+#include "Entity.h"
+#include "PendingInputs.h"
+
+// Reports what reconciling the player against each world state costs the client, at a range of round trip times and
+// frame rates. The client loop is played out the same way the client runs it: input is sampled at a fixed rate,
+// however fast frames come, and each world state acknowledges the last input the server had a round trip ago.
+//
+// Two ways of reconciling are timed, each including the Acknowledge which comes before it:
+//     replay  moving the player to the server position and applying every pending input again.
+//     totals  comparing against the running totals of displacement, which is what the client does.
+
+using Clock = std::chrono::steady_clock;
+
+// How long each round trip and frame rate is played out for.
+static constexpr double Duration = 20.0;
+
+static constexpr float InputStepLength = 1.0f / Config::InputRate;
+static constexpr auto MaxCatchUpSteps = 5;
+
+// The same as the client, see ReconcileEpsilon there.
+static constexpr float ReconcileEpsilon = 1.25f / static_cast<float>(1u << Config::PositionFractionBits);
+
+// Reading the clock is not free, this much is taken off every time measured.
+static double s_ClockOverhead = 0.0;
+
+static double Elapsed(Clock::time_point start, Clock::time_point end)
+{
+	return std::max(std::chrono::duration<double, std::nano>(end - start).count() - s_ClockOverhead, 0.0);
+}
+
+static void MeasureClockOverhead()
+{
+	std::vector<double> samples(10000);
+	for (auto& sample : samples)
+	{
+		auto start = Clock::now();
+		sample = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	}
+	std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+	s_ClockOverhead = samples[samples.size() / 2];
+}
+
+// Moves the player to where the server put it, then applies every input the server has not applied yet on top.
+static void ReconcileByReplay(PendingInputs& pending, EntityStore& world, uint32_t sequence, float serverX, float serverY)
+{
+	pending.Acknowledge(sequence);
+	world.X[0] = serverX;
+	world.Y[0] = serverY;
+	for (uint32_t i = 0; i < pending.GetCount(); i++)
+	{
+		world.ApplyInput(0, pending.Get(i));
+	}
+}
+
+// Moves the player by however far its prediction was off, if it was off by enough to matter.
+static void ReconcileByTotals(PendingInputs& pending, EntityStore& world, uint32_t sequence, float serverX, float serverY)
+{
+	pending.Acknowledge(sequence);
+
+	float pendingX, pendingY;
+	pending.GetPendingDisplacement(pendingX, pendingY);
+
+	float errorX = serverX - (world.X[0] - pendingX);
+	float errorY = serverY - (world.Y[0] - pendingY);
+	if (std::abs(errorX) <= ReconcileEpsilon && std::abs(errorY) <= ReconcileEpsilon) { return; }
+
+	world.X[0] += errorX;
+	world.Y[0] += errorY;
+}
+
+struct Result
+{
+	double Pending = 0.0;
+	double ReplayNanoseconds = 0.0;
+	double TotalsNanoseconds = 0.0;
+};
+
+static Result MeasureSteady(double roundTrip, double frameRate)
+{
+	// Each way of reconciling gets its own copy of everything, fed the same inputs.
+	PendingInputs replayInputs;
+	PendingInputs totalsInputs;
+	EntityStore replayWorld;
+	EntityStore totalsWorld;
+	EntityStore serverWorld;
+	replayWorld.Add();
+	totalsWorld.Add();
+	serverWorld.Add();
+
+	// When each input was sampled, indexed by sequence number.
+	std::vector<double> sampledAt(1, 0.0);
+	std::vector<InputSnapshot> inputs(1);
+
+	Result result;
+	uint32_t worldStates = 0;
+	uint32_t applied = 0;
+	double time = 0.0;
+	double accumulator = 0.0;
+	double nextWorldState = 0.0;
+	double frameLength = 1.0 / frameRate;
+	while (time < Duration)
+	{
+		time += frameLength;
+		accumulator += frameLength;
+
+		for (int steps = 0; accumulator >= InputStepLength && steps < MaxCatchUpSteps; steps++)
+		{
+			accumulator -= InputStepLength;
+			if (replayInputs.IsFull()) { continue; }
+
+			// Zig zag, so the player never stands still.
+			uint32_t sequence = static_cast<uint32_t>(inputs.size());
+			InputSnapshot input(sequence, InputStepLength, (sequence / 16) % 2 == 0 ? 1.0f : -1.0f, (sequence / 24) % 2 == 0 ? 1.0f : -1.0f);
+			inputs.push_back(input);
+			sampledAt.push_back(time);
+
+			replayWorld.ApplyInput(0, input);
+			totalsWorld.ApplyInput(0, input);
+			replayInputs.Push(input);
+			totalsInputs.Push(input);
+		}
+
+		if (time < nextWorldState) { continue; }
+		nextWorldState += 1.0 / Config::ServerTimestep;
+
+		// The server has applied every input which was sampled at least a round trip ago.
+		while (applied + 1 < inputs.size() && sampledAt[applied + 1] <= time - roundTrip)
+		{
+			applied++;
+			serverWorld.ApplyInput(0, inputs[applied]);
+		}
+		if (applied == 0) { continue; }
+
+		result.Pending += replayInputs.GetCount();
+
+		auto start = Clock::now();
+		ReconcileByReplay(replayInputs, replayWorld, applied, serverWorld.X[0], serverWorld.Y[0]);
+		auto end = Clock::now();
+		result.ReplayNanoseconds += Elapsed(start, end);
+
+		start = Clock::now();
+		ReconcileByTotals(totalsInputs, totalsWorld, applied, serverWorld.X[0], serverWorld.Y[0]);
+		end = Clock::now();
+		result.TotalsNanoseconds += Elapsed(start, end);
+
+		worldStates++;
+	}
+
+	result.Pending /= worldStates;
+	result.ReplayNanoseconds /= worldStates;
+	result.TotalsNanoseconds /= worldStates;
+	return result;
+}
+
+// After a stall, the server acknowledges three quarters of the pending inputs at once.
+static Result MeasureStall(uint32_t pendingCount)
+{
+	static constexpr int Repeats = 200;
+
+	Result result;
+	result.Pending = pendingCount;
+	for (int r = 0; r < Repeats; r++)
+	{
+		PendingInputs replayInputs;
+		PendingInputs totalsInputs;
+		EntityStore replayWorld;
+		EntityStore totalsWorld;
+		replayWorld.Add();
+		totalsWorld.Add();
+
+		for (uint32_t sequence = 1; sequence <= pendingCount; sequence++)
+		{
+			InputSnapshot input(sequence, InputStepLength, 1.0f, 0.0f);
+			replayWorld.ApplyInput(0, input);
+			totalsWorld.ApplyInput(0, input);
+			replayInputs.Push(input);
+			totalsInputs.Push(input);
+		}
+
+		uint32_t acknowledged = pendingCount * 3 / 4;
+		float serverX = acknowledged * InputStepLength * EntityStore::Speed;
+
+		auto start = Clock::now();
+		ReconcileByReplay(replayInputs, replayWorld, acknowledged, serverX, 0.0f);
+		auto end = Clock::now();
+		result.ReplayNanoseconds += Elapsed(start, end);
+
+		start = Clock::now();
+		ReconcileByTotals(totalsInputs, totalsWorld, acknowledged, serverX, 0.0f);
+		end = Clock::now();
+		result.TotalsNanoseconds += Elapsed(start, end);
+	}
+
+	result.ReplayNanoseconds /= Repeats;
+	result.TotalsNanoseconds /= Repeats;
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	// Usage: reconcile_bench [--rtt <ms>] [--fps <hz>]
+	// Either one narrows the table down to that value.
+	std::vector<double> roundTrips = { 50, 100, 200, 500, 1000 };
+	std::vector<double> frameRates = { 60, 144, 240, 1000 };
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) == "--rtt" && i + 1 < argc)
+		{
+			roundTrips = { std::atof(argv[++i]) };
+		}
+		else if (std::string(argv[i]) == "--fps" && i + 1 < argc)
+		{
+			frameRates = { std::atof(argv[++i]) };
+		}
+	}
+
+	MeasureClockOverhead();
+
+	std::cout << "Per world state, " << Config::InputRate << " inputs a second, " << Config::ServerTimestep << " world states a second." << std::endl << std::endl;
+	std::cout << "  rtt    fps   pending   replay ns   totals ns" << std::endl;
+	std::cout << std::fixed;
+	for (double roundTrip : roundTrips)
+	{
+		for (double frameRate : frameRates)
+		{
+			Result result = MeasureSteady(roundTrip / 1000.0, frameRate);
+			std::cout << std::setw(5) << std::setprecision(0) << roundTrip << std::setw(7) << frameRate
+				<< std::setw(10) << std::setprecision(1) << result.Pending
+				<< std::setw(12) << std::setprecision(0) << result.ReplayNanoseconds
+				<< std::setw(12) << result.TotalsNanoseconds << std::endl;
+		}
+	}
+
+	std::cout << std::endl << "After a stall, acknowledging three quarters of the pending inputs at once." << std::endl << std::endl;
+	std::cout << "pending   replay ns   totals ns" << std::endl;
+	for (uint32_t pendingCount : { 64u, 256u, PendingInputs::Capacity })
+	{
+		Result result = MeasureStall(pendingCount);
+		std::cout << std::setw(7) << pendingCount << std::setw(12) << std::setprecision(0) << result.ReplayNanoseconds
+			<< std::setw(12) << result.TotalsNanoseconds << std::endl;
+	}
+
+	return 0;
+}
@@ -1,63 +1,116 @@
 #include <array>
+#include <chrono>
 #include <olcPixelGameEngine.h>
 #include <enet.h>
 
 #include "SharedConfig.h"
 #include "Packet.h"
 #include "Entity.h"
-
-static constexpr auto ConnectionTimeout = 800;
-static constexpr auto DisconnectTimeout = 800;
-static constexpr auto ServerAddress = "127.0.0.1";
+#include "Snapshot.h"
+#include "Compression.h"
+#include "ClientNetwork.h"
+#include "PendingInputs.h"
+#include "PositionHistory.h"
+#include "InterpolationDelay.h"
+#include "ClockSync.h"
+
+// The length of a single input step.
+static constexpr float InputStepLength = 1.0f / Config::InputRate;
+
+// The most input steps taken back to back after a long frame. Anything beyond this is dropped, the server would
+// not let us use up that much time at once anyway.
+static constexpr auto MaxCatchUpSteps = 5;
+
+// Prediction errors up to this are left alone. Positions are rounded to the nearest fixed point step when they are
+// sent, and an earlier correction may have left the prediction on one of those steps too, so the two can be a whole
+// step apart without anything having gone wrong. The extra quarter covers the server adding up the same movement in
+// a different order.
+static constexpr float ReconcileEpsilon = 1.25f / static_cast<float>(1u << Config::PositionFractionBits);
+
+// Corrections are drawn as if they were eased in over about this long, in seconds, unless they are larger than
+// the maximum, which could only be a teleport and is drawn straight away.
+static constexpr float CorrectionSmoothing = 0.1f;
+static constexpr float MaxSmoothedCorrection = 32.0f;
 
 // Represents the state of the game.
-// The game is initially in the handshaking state, it switches to the playing state
-// once the client has received it's ID from the server.
+// The game starts out connecting, which keeps being retried until the server accepts us. Once it has, the game is
+// in the handshaking state, and switches to the playing state once the client has received it's ID from the server.
+// None of these wait on the network, so a frame is drawn whatever state we are in.
 enum class GameState
 {
+	Disconnected,
+	Connecting,
 	Handshaking,
-	Playing
-};
-
-struct EntityPosition
-{
-	float Timestamp = 0;
-	float X = 0;
-	float Y = 0;
-
-	EntityPosition() = default;
-	EntityPosition(const EntityPosition&) = default;
-
-	EntityPosition(float ts, float x, float y)
-		: Timestamp(ts), X(x), Y(y)
-	{
-	}
+	Playing,
+	Disconnecting
 };
 
 struct Player
 {
-	Entity WorldEntity;
-	std::vector<EntityPosition> PositionBuffer;
+	// The index of the players entity in the world.
+	uint32_t Index = 0;
+	PositionHistory Positions;
+
+	// The last world state the entity was in. The server only sends the entities near us, so anything
+	// missing from a world state has gone out of view.
+	uint32_t LastSeen = 0;
 };
 
 class NetworkedGame : public olc::PixelGameEngine
 {
 private:
-	ENetHost* m_Client;
-	ENetPeer* m_Peer;
-	bool m_Connected = false;
-	GameState m_State = GameState::Handshaking;
+	// The connection to the server, which runs on its own thread.
+	ClientNetwork m_Network;
+	GameState m_State = GameState::Disconnected;
+
+	// The attempt at connecting we are on, and when the next one will be if it is waiting to retry.
+	uint32_t m_ConnectAttempt = 0;
+	float m_NextConnectAttempt = 0.0f;
 
 	uint32_t m_PlayerID = -1;
-	std::array<Player*, Config::MaxClients> m_Entities{ nullptr };
+
+	// Indexed by entity ID. Entity IDs are handed out in ranges per server shard, so this grows as
+	// new IDs are seen.
+	std::vector<Player*> m_Entities;
+
+	// The position of every entity, shared by prediction, interpolation and rendering.
+	EntityStore m_World;
+
+	// The ID of the entity at each index of the world.
+	std::vector<uint32_t> m_WorldIDs;
 
 	float m_GameTime = 0.0f;
 
-	std::vector<InputSnapshot> m_PendingInputs;
-	uint32_t m_InputSequenceNumber = 0;
+	// Our estimate of the server timeline, which interpolation and input sampling follow. The server time is
+	// updated once a frame.
+	ClockSync m_Clock;
+	double m_ServerTime = 0.0;
+	uint32_t m_ServerTick = 0;
+
+	PendingInputs m_PendingInputs;
+	float m_LastInputSendTime = 0.0f;
+
+	// How far from its actual position the player is drawn, while a correction is being smoothed out.
+	float m_CorrectionX = 0.0f;
+	float m_CorrectionY = 0.0f;
+
+	// Frame time which has not been turned into input steps yet.
+	float m_InputAccumulator = 0.0f;
+
+	// How far in the past other entities are drawn.
+	InterpolationDelay m_InterpolationDelay{ 1.0f / Config::ServerTimestep };
+
+	// The server reports having processed input 0 before it has seen any, so we start from 1.
+	uint32_t m_InputSequenceNumber = 1;
 public:
+	explicit NetworkedGame(const CompressionSettings& compression)
+		: m_Network(compression)
+	{
+	}
+
 	bool OnUserCreate() override
 	{
+		m_Network.Start();
 		Connect();
 
 		return true;
@@ -65,80 +118,96 @@ public:
 
 	bool OnUserDestroy() override
 	{
-		Disconnect();
+		// Stopping the network thread disconnects us.
+		m_Network.Stop();
 
 		return true;
 	}
 
+	// Asks the network thread to connect, which it keeps trying until it has. If it is already waiting to try
+	// again, it tries right away instead. It lets us know how it is getting on through events.
 	void Connect()
 	{
-		if (m_Connected) { return; }
+		if (m_State != GameState::Disconnected && m_State != GameState::Connecting) { return; }
 
-		m_Client = enet_host_create(nullptr, 1, 1, 0, 0);
-		if (m_Client == nullptr)
-		{
-			std::cout << "Failed to create ENet host." << std::endl;
-			return;
-		}
+		m_State = GameState::Connecting;
+		m_Network.Connect();
+	}
 
-		std::cout << "Attempting to connect to " << ServerAddress << ":" << Config::Port << "." << std::endl;
+	// Asks the network thread to disconnect, or to stop trying to connect. It lets us know once it has.
+	void Disconnect()
+	{
+		if (m_State == GameState::Disconnected || m_State == GameState::Disconnecting) { return; }
 
-		ENetAddress address = { 0 };
-		enet_address_set_host(&address, ServerAddress);
-		address.port = Config::Port;
+		m_State = GameState::Disconnecting;
+		m_Network.Disconnect();
+	}
 
-		m_Peer = enet_host_connect(m_Client, &address, 1, 0);
-		if (m_Peer == nullptr)
+	// Starts the game over, once we have a new connection. Nothing from the last connection carries over, the server
+	// may have restarted since, handing out the same entity IDs on a new timeline.
+	void ResetGame()
+	{
+		for (uint32_t id = 0; id < m_Entities.size(); id++)
 		{
-			std::cout << "Failed to initiate connection to peer." << std::endl;
-			return;
+			RemoveEntity(id);
 		}
+		m_Entities.clear();
+		m_PlayerID = -1;
+
+		m_PendingInputs.Clear();
+		m_CorrectionX = m_CorrectionY = 0.0f;
+		m_InputAccumulator = 0.0f;
+		m_InterpolationDelay.Reset();
+		m_Clock = {};
+		m_ServerTime = m_Network.GetLocalTime();
+	}
 
-		ENetEvent event;
-		if (enet_host_service(m_Client, &event, ConnectionTimeout) > 0 && event.type == ENET_EVENT_TYPE_CONNECT)
+	// Returns the entity with the given ID, creating it if it does not exist yet.
+	Player* GetEntity(uint32_t id)
+	{
+		if (id >= m_Entities.size())
 		{
-			std::cout << "Connected to server." << std::endl;
-			m_Connected = true;
-			return;
+			m_Entities.resize(id + 1, nullptr);
 		}
-		else
+
+		if (m_Entities[id] == nullptr)
 		{
-			std::cout << "Failed to connect to server." << std::endl;
-			enet_peer_reset(m_Peer);
-			return;
+			m_Entities[id] = new Player;
+			m_Entities[id]->Index = m_World.Add();
+			m_WorldIDs.push_back(id);
 		}
+
+		return m_Entities[id];
 	}
 
-	void Disconnect()
+	// Removes an entity which has gone out of view.
+	void RemoveEntity(uint32_t id)
 	{
-		if (!m_Connected) { return; }
+		auto entity = m_Entities[id];
+		if (entity == nullptr) { return; }
 
-		ENetEvent event;
-		enet_peer_disconnect(m_Peer, 0);
-		while (enet_host_service(m_Client, &event, DisconnectTimeout) > 0)
+		// The last entity in the world moves into the hole.
+		uint32_t last = static_cast<uint32_t>(m_World.Size() - 1);
+		if (entity->Index != last)
 		{
-			switch (event.type)
-			{
-			case ENET_EVENT_TYPE_RECEIVE: {
-				enet_packet_destroy(event.packet);
-			} break;
-			case ENET_EVENT_TYPE_DISCONNECT: {
-				std::cout << "Gracefully disconnect from server." << std::endl;
-				m_Connected = false;
-				enet_host_destroy(m_Client);
-				return;
-			} break;
-			}
+			uint32_t movedID = m_WorldIDs[last];
+			m_WorldIDs[entity->Index] = movedID;
+			m_Entities[movedID]->Index = entity->Index;
 		}
 
-		enet_peer_reset(m_Peer);
-		enet_host_destroy(m_Client);
-		std::cout << "Forcefully disconnect from server." << std::endl;
-		m_Connected = false;
+		m_World.Remove(entity->Index);
+		m_WorldIDs.pop_back();
+
+		delete entity;
+		m_Entities[id] = nullptr;
 	}
 
-	InputSnapshot GetPlayerInput(float dt)
+	// Samples the input for a single step.
+	InputSnapshot GetPlayerInput()
 	{
+		// Use the same delta time the server will see, so our prediction matches what it does.
+		float dt = InputPacket::RoundDeltaTime(InputStepLength);
+
 		float dx = 0.0f;
 		float dy = 0.0f;
 
@@ -166,152 +235,182 @@ public:
 		return InputSnapshot();
 	}
 
+	// Handles everything the network thread has passed on since the last frame.
 	void NetworkPoll()
 	{
-		if (!m_Connected) { return; }
-
-		ENetEvent event;
-		while (enet_host_service(m_Client, &event, 1) > 0)
+		NetworkEvent event;
+		while (m_Network.PollEvent(event))
 		{
-			switch (event.type)
+			switch (event.Type)
 			{
-			case ENET_EVENT_TYPE_CONNECT: {
-				std::cout << "ENET_EVENT_TYPE_CONNECT" << std::endl;
+			// Anything which was already on its way when we asked to disconnect is ignored.
+			case NetworkEventType::Connecting: {
+				if (m_State == GameState::Disconnecting) { break; }
+				m_State = GameState::Connecting;
+				m_ConnectAttempt = event.Attempt;
+				m_NextConnectAttempt = 0.0f;
 			} break;
-			case ENET_EVENT_TYPE_DISCONNECT: {
-				std::cout << "ENET_EVENT_TYPE_DISCONNECT" << std::endl;
+			case NetworkEventType::Retrying: {
+				if (m_State == GameState::Disconnecting) { break; }
+				m_State = GameState::Connecting;
+				m_NextConnectAttempt = m_GameTime + static_cast<float>(event.RetryDelay);
 			} break;
-			case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT: {
-				std::cout << "ENET_EVENT_TYPE_DISCONNECT_TIMEOUT" << std::endl;
+			case NetworkEventType::Connected: {
+				if (m_State == GameState::Disconnecting) { break; }
+				ResetGame();
+				m_State = GameState::Handshaking;
 			} break;
-			case ENET_EVENT_TYPE_RECEIVE: {
-				DataReader reader(event.packet->data, event.packet->dataLength);
-
-				// Read the packet ID from the buffer.
-				uint8_t packetID = reader.Read<uint8_t>();
-
-				// Create the packet based on its ID.
-				auto packet = Packet::CreateFromID(packetID);
-
-				// Read the rest of the packet from the buffer.
-				packet->Read(reader);
-
-				// Handle the packet.
-				HandlePacket(packet);
-
-				enet_packet_destroy(event.packet);
+			case NetworkEventType::Disconnected: {
+				m_State = GameState::Disconnected;
+			} break;
+			case NetworkEventType::Welcome: {
+				if (m_State != GameState::Handshaking) { break; }
+				HandleWelcome(event);
+			} break;
+			case NetworkEventType::WorldState: {
+				HandleWorldState(m_Network.GetWorldState(event.Slot), event);
+				m_Network.ReleaseWorldState(event.Slot);
+			} break;
+			case NetworkEventType::Pong: {
+				HandlePong(event);
 			} break;
 			}
 		}
 	}
 
-	void SendPacket(const std::shared_ptr<Packet>& packet)
+	// Sends the most recent inputs the server has not acknowledged.
+	void SendInputs()
 	{
-		if (!m_Connected) { return; }
+		InputPacket packet;
+		packet.InputCount = std::min(m_PendingInputs.GetCount(), InputPacket::MaxInputs);
 
-		// Write the packet to a buffer.
-		DataWriter writer;
-		writer.Write<uint8_t>(static_cast<uint8_t>(packet->Type));
-		packet->Write(writer);
+		uint32_t first = m_PendingInputs.GetCount() - packet.InputCount;
+		for (uint32_t i = 0; i < packet.InputCount; i++)
+		{
+			packet.Inputs[i] = m_PendingInputs.Get(first + i);
+		}
 
-		// Hand it off to ENet.
-		// Note that ENet will copy the data to its own internal buffer.
-		enet_peer_send(m_Peer, 0, enet_packet_create(writer.GetData(), writer.GetSize(), ENET_PACKET_FLAG_RELIABLE));
+		m_Network.Send(packet);
+		m_LastInputSendTime = m_GameTime;
 	}
 
-	void HandlePacket(const std::shared_ptr<Packet>& p)
+	void HandleWelcome(const NetworkEvent& welcome)
 	{
-		switch (p->Type)
-		{
-		case PacketType::Welcome: {
-			auto packet = std::dynamic_pointer_cast<WelcomePacket>(p);
+		// Assign the players ID.
+		m_PlayerID = welcome.ClientID;
 
-			// Assign the players ID.
-			m_PlayerID = packet->ClientID;
+		// Start off on the server timeline, until the first ping comes back.
+		m_Clock.Start(welcome.ServerTime, welcome.Received);
+		m_ServerTime = m_Clock.GetServerTime(m_Network.GetLocalTime());
+		m_ServerTick = welcome.Tick;
 
-			// Create the players entity.
-			m_Entities[m_PlayerID] = new Player;
+		// Other entities are drawn at least one world state behind, however often the server sends them.
+		m_InterpolationDelay = InterpolationDelay(InterpolationDelay::GetInterval(welcome.SnapshotRate));
 
-			// Move to the playing state.
-			m_State = GameState::Playing;
-		} break;
-		case PacketType::WorldState: {
-			auto packet = std::dynamic_pointer_cast<WorldStatePacket>(p);
+		// Create the players entity.
+		GetEntity(m_PlayerID);
+
+		// Move to the playing state.
+		m_State = GameState::Playing;
+	}
+
+	// Applies a world state the network thread has decoded.
+	void HandleWorldState(const Snapshot& snapshot, const NetworkEvent& event)
+	{
+		// Anything still queued up from before a disconnect is ignored.
+		if (m_State != GameState::Playing) { return; }
 
-			for (auto& entry : packet->Entries)
+		m_ServerTick = snapshot.Sequence;
+
+		// Positions are stamped with when their tick was due on the server, rather than when they arrived, so
+		// however unevenly they arrive they are drawn as evenly as they were taken.
+		double tickTime = m_Clock.ReadServerTime(event.ServerTime);
+		m_InterpolationDelay.OnArrival(tickTime, m_Clock.GetServerTime(event.Received));
+
+		for (auto& entry : snapshot.Entries)
+		{
+			GetEntity(entry.EntityID)->LastSeen = snapshot.Sequence;
+
+			if (entry.EntityID == m_PlayerID)
 			{
-				if (entry.EntityID == m_PlayerID)
-				{
-					m_Entities[entry.EntityID]->WorldEntity.X = entry.X;
-					m_Entities[entry.EntityID]->WorldEntity.Y = entry.Y;
-
-					// Perform reconciliation.
-					uint32_t j = 0;
-					while (j < m_PendingInputs.size())
-					{
-						auto& input = m_PendingInputs[j];
-						if (input.SequenceNumber <= entry.PreviousInput)
-						{
-							// This input has been processed by the server, so drop it.
-							m_PendingInputs.erase(m_PendingInputs.begin() + j);
-						}
-						else
-						{
-							// This input has not been processed by the server yet, so reapply it.
-							m_Entities[entry.EntityID]->WorldEntity.Update(input);
-							j++;
-						}
-					}
-				}
-				else
-				{
-					if (m_Entities[entry.EntityID] == nullptr)
-					{
-						// If we encounter a new entity, create it.
-						m_Entities[entry.EntityID] = new Player;
-					}
-			
-					// Add the position to the entities position buffer for interpolation.
-					m_Entities[entry.EntityID]->PositionBuffer.push_back(EntityPosition(m_GameTime, entry.X, entry.Y));
-				}
+				// Perform reconciliation. Drop the inputs the server has processed, and work out where we
+				// predicted we would be after the last of them by taking the rest off our current position. That
+				// only needs correcting if the server put us somewhere else.
+				m_PendingInputs.Acknowledge(entry.PreviousInput);
+				Reconcile(GetEntity(entry.EntityID)->Index, entry.X, entry.Y);
+			}
+			else
+			{
+				// If we encounter a new entity, this will create it.
+				auto entity = GetEntity(entry.EntityID);
+
+				// Add the position to the entities position history for interpolation.
+				EntityPosition position(tickTime, entry.X, entry.Y);
+				if (event.HasVelocity) { position.SetVelocity(entry.VelocityX, entry.VelocityY); }
+				entity->Positions.Push(position);
+			}
+		}
+
+		// Anything which was not in this world state has left our view.
+		for (uint32_t id = 0; id < m_Entities.size(); id++)
+		{
+			if (m_Entities[id] != nullptr && id != m_PlayerID && m_Entities[id]->LastSeen != snapshot.Sequence)
+			{
+				RemoveEntity(id);
 			}
-		} break;
 		}
 	}
 
-	void InterpolateEntities()
+	// Moves the player by however far its prediction was off from the position the server sent, which is the
+	// same as moving it there and applying the pending inputs again.
+	void Reconcile(uint32_t index, float serverX, float serverY)
 	{
-		// Some time in the past.
-		float renderTimestamp = m_GameTime - (1.0f / Config::ServerTimestep);
+		float pendingX, pendingY;
+		m_PendingInputs.GetPendingDisplacement(pendingX, pendingY);
+
+		float errorX = serverX - (m_World.X[index] - pendingX);
+		float errorY = serverY - (m_World.Y[index] - pendingY);
+		if (std::abs(errorX) <= ReconcileEpsilon && std::abs(errorY) <= ReconcileEpsilon) { return; }
+
+		m_World.X[index] += errorX;
+		m_World.Y[index] += errorY;
 
-		for (auto entity : m_Entities)
+		m_CorrectionX -= errorX;
+		m_CorrectionY -= errorY;
+		if (std::abs(m_CorrectionX) > MaxSmoothedCorrection || std::abs(m_CorrectionY) > MaxSmoothedCorrection)
 		{
-			if (entity == nullptr) { continue; }
-			if (entity == m_Entities[m_PlayerID]) { continue; }
+			m_CorrectionX = m_CorrectionY = 0.0f;
+		}
+	}
 
-			auto& buffer = entity->PositionBuffer;
+	void HandlePong(const NetworkEvent& pong)
+	{
+		if (m_State != GameState::Playing) { return; }
 
-			// Drop all older positions.
-			while (buffer.size() >= 2 && buffer[1].Timestamp <= renderTimestamp)
-			{
-				buffer.erase(buffer.begin());
-			}
+		double serverReceived = m_Clock.ReadServerTime(pong.ServerReceived);
+		double serverSent = m_Clock.ReadServerTime(pong.ServerSent);
+		m_Clock.AddSample(pong.PingSent, serverReceived, serverSent, pong.Received);
+	}
 
-			// Interpolate between the two newest positions.
-			if (buffer.size() >= 2 && buffer[0].Timestamp <= renderTimestamp && renderTimestamp <= buffer[1].Timestamp)
-			{
-				auto x0 = buffer[0].X;
-				auto x1 = buffer[1].X;
-				auto y0 = buffer[0].Y;
-				auto y1 = buffer[1].Y;
+	void InterpolateEntities(float dt)
+	{
+		// Some time in the past, far enough back that there should be a newer position to move towards.
+		double renderTimestamp = m_ServerTime - m_InterpolationDelay.Update(dt);
 
-				auto t0 = buffer[0].Timestamp;
-				auto t1 = buffer[1].Timestamp;
+		bool underrun = false;
+		for (uint32_t id = 0; id < m_Entities.size(); id++)
+		{
+			auto entity = m_Entities[id];
+			if (entity == nullptr) { continue; }
+			if (id == m_PlayerID) { continue; }
+			if (entity->Positions.IsEmpty()) { continue; }
 
-				entity->WorldEntity.X = x0 + (x1 - x0) * (renderTimestamp - t0) / (t1 - t0);
-				entity->WorldEntity.Y = y0 + (y1 - y0) * (renderTimestamp - t0) / (t1 - t0);
-			}
+			// If there is nothing new enough the entity is left at its newest position until more arrive.
+			auto index = entity->Index;
+			underrun |= !entity->Positions.Sample(renderTimestamp, m_World.X[index], m_World.Y[index]);
 		}
+
+		if (underrun) { m_InterpolationDelay.OnUnderrun(); }
 	}
 
 	bool OnUserUpdate(float dt) override
@@ -325,60 +424,151 @@ public:
 		if (GetKey(olc::Key::C).bPressed) { Connect(); }
 		if (GetKey(olc::Key::ESCAPE).bPressed) { Disconnect(); }
 
-		// Player input.
+		// Follow the server timeline. If the clock had to be stepped, the lateness of world states has to be
+		// measured again.
+		double localTime = m_Network.GetLocalTime();
+		if (m_Clock.Update(localTime)) { m_InterpolationDelay.Resynchronize(); }
+
+		double previousServerTime = m_ServerTime;
+		m_ServerTime = m_Clock.GetServerTime(localTime);
+
+		// Player input is sampled in fixed steps rather than once a frame, so the server gets the same number of
+		// inputs from every client whatever its frame rate, and each input covers a whole tick. The steps follow
+		// the server timeline, so we send input as fast as the server uses it up even if our clocks drift apart.
+		m_InputAccumulator += static_cast<float>(std::max(m_ServerTime - previousServerTime, 0.0));
+		uint32_t steps = 0;
+		while (m_InputAccumulator >= InputStepLength && steps < MaxCatchUpSteps)
+		{
+			m_InputAccumulator -= InputStepLength;
+			steps++;
+		}
+		if (steps == MaxCatchUpSteps) { m_InputAccumulator = std::min(m_InputAccumulator, InputStepLength); }
+
 		if (m_State == GameState::Playing)
 		{
-			// Only allow player input in the playing state.
-			if (auto input = GetPlayerInput(dt); input.HasInput())
+			bool sampled = false;
+			for (uint32_t i = 0; i < steps; i++)
 			{
-				// Send the input to the server.
-				auto packet = Packet::Create<InputPacket>();
-				packet->Input = input;
-				SendPacket(packet);
+				// If the server has stopped acknowledging our inputs for so long that there is no room left to keep
+				// them for reconciliation, the player stops until it catches up.
+				if (m_PendingInputs.IsFull()) { break; }
 
-				// Apply the input locally right away (prediction).
-				m_Entities[m_PlayerID]->WorldEntity.Update(input);
+				if (auto input = GetPlayerInput(); input.HasInput())
+				{
+					// Apply the input locally right away (prediction), and save it for reconciliation.
+					m_World.ApplyInput(GetEntity(m_PlayerID)->Index, input);
+					m_PendingInputs.Push(input);
+					sampled = true;
+				}
+			}
 
-				// Save the input for reconciliation.
-				m_PendingInputs.push_back(input);
+			// Every step taken this frame goes out in a single packet, along with the earlier inputs the server has
+			// not acknowledged yet. If the last packet was lost and there is no new input to carry them instead,
+			// they are sent again at the tick rate until the server acknowledges them.
+			bool resend = m_PendingInputs.GetCount() > 0 && m_GameTime - m_LastInputSendTime >= 1.0f / Config::ServerTimestep;
+			if (sampled || resend)
+			{
+				SendInputs();
 			}
 		}
 
-		InterpolateEntities();
+		InterpolateEntities(dt);
+
+		// Ease out whatever correction is left.
+		float decay = std::exp(-dt / CorrectionSmoothing);
+		m_CorrectionX *= decay;
+		m_CorrectionY *= decay;
 
 		// Render.
 		Clear(olc::BLACK);
-		for (auto entity : m_Entities)
+		auto player = m_State == GameState::Playing ? GetEntity(m_PlayerID)->Index : UINT32_MAX;
+		for (size_t i = 0; i < m_World.Size(); i++)
 		{
-			if (entity == nullptr) { continue; }
-			FillRect(entity->WorldEntity.X, entity->WorldEntity.Y, 16, 16);
+			float x = m_World.X[i];
+			float y = m_World.Y[i];
+			if (i == player)
+			{
+				x += m_CorrectionX;
+				y += m_CorrectionY;
+			}
+			FillRect(x, y, 16, 16);
 		}
 
-		if (m_Connected)
-		{
-			DrawString(2, 2, "Connected.", olc::DARK_GREEN);
-		}
-		else
+		switch (m_State)
 		{
+		case GameState::Disconnected: {
 			DrawString(2, 2, "Not connected.", olc::DARK_RED);
+		} break;
+		case GameState::Connecting: {
+			auto status = "Connecting, attempt " + std::to_string(m_ConnectAttempt);
+			if (m_NextConnectAttempt > m_GameTime)
+			{
+				auto wait = static_cast<int>((m_NextConnectAttempt - m_GameTime) * 10.0f + 1.0f);
+				status += ", retrying in " + std::to_string(wait / 10) + "." + std::to_string(wait % 10) + "s";
+			}
+			DrawString(2, 2, status + ".", olc::YELLOW);
+		} break;
+		case GameState::Handshaking: {
+			DrawString(2, 2, "Connected, waiting for the server.", olc::YELLOW);
+		} break;
+		case GameState::Playing: {
+			DrawString(2, 2, "Connected.", olc::DARK_GREEN);
+		} break;
+		case GameState::Disconnecting: {
+			DrawString(2, 2, "Disconnecting.", olc::DARK_RED);
+		} break;
 		}
 
-		uint32_t rtt = enet_peer_get_rtt(m_Peer);
+		uint32_t rtt = m_Network.GetRoundTripTime();
 		DrawString(2, 12, "Ping: " + std::to_string(rtt) + "ms");
 
+		auto delay = static_cast<int>(m_InterpolationDelay.GetDelay() * 1000.0f);
+		auto jitter = static_cast<int>(m_InterpolationDelay.GetJitter() * 1000.0f);
+		DrawString(2, 22, "Interpolation delay: " + std::to_string(delay) + "ms (jitter " + std::to_string(jitter) + "ms)");
+		DrawString(2, 32, "Underruns: " + std::to_string(m_InterpolationDelay.GetUnderruns()));
+
+		// How far our estimate of the server time could be off, and how fast our clocks drift apart.
+		auto error = m_Clock.GetError(localTime);
+		auto drift = static_cast<int>(m_Clock.GetDrift() * 1e6);
+		auto errorText = std::isinf(error) ? std::string("unknown") : std::to_string(static_cast<int>(error * 1e6)) + "us";
+		DrawString(2, 42, "Tick " + std::to_string(m_ServerTick) + ", clock error " + errorText + ", drift " + std::to_string(drift) + "ppm");
+
 		return true;
 	}
 };
 
 int main(int argc, char** argv)
 {
+	// Usage: client [--compression <none|lz|range>] [--compression-dictionary <file>]
+	// Both must match what the server was started with.
+	CompressionSettings compression;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) == "--compression" && i + 1 < argc)
+		{
+			if (!Compression::ParseType(argv[++i], compression.Type))
+			{
+				std::cout << "Unknown compression type " << argv[i] << "." << std::endl;
+				std::exit(1);
+			}
+		}
+		else if (std::string(argv[i]) == "--compression-dictionary" && i + 1 < argc)
+		{
+			if (!Compression::LoadDictionary(argv[++i], compression.Dictionary))
+			{
+				std::cout << "Failed to load compression dictionary " << argv[i] << "." << std::endl;
+				std::exit(1);
+			}
+		}
+	}
+
 	if (enet_initialize() != 0)
 	{
 		std::cout << "Failed to initialize ENet." << std::endl;
 		std::exit(1);
 	}
 
-	NetworkedGame game;
+	NetworkedGame game(compression);
 	game.Construct(640, 360, 2, 2);
 	game.Start();
 
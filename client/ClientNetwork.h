@@ -0,0 +1,646 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+#include <enet.h>
+
+#include "SharedConfig.h"
+#include "Packet.h"
+#include "Snapshot.h"
+#include "Delivery.h"
+#include "PacketPool.h"
+#include "Compression.h"
+#include "SpscQueue.h"
+
+// Events passed from the network thread to the game thread.
+enum class NetworkEventType : uint8_t
+{
+	// An attempt to connect has started.
+	Connecting,
+
+	// An attempt to connect failed, or the connection was lost, and we will try again after a while.
+	Retrying,
+
+	Connected,
+	Disconnected,
+	Welcome,
+	WorldState,
+	Pong
+};
+
+struct NetworkEvent
+{
+	NetworkEventType Type = NetworkEventType::Connected;
+
+	// When the packet behind the event arrived, on our own clock.
+	double Received = 0.0;
+
+	// Which attempt at connecting this is, counting from one, and how long until the next one, in seconds.
+	uint32_t Attempt = 0;
+	double RetryDelay = 0.0;
+
+	// The welcome.
+	uint32_t ClientID = 0;
+	uint32_t Tick = 0;
+	uint32_t SnapshotRate = 0;
+
+	// The server time of the welcome or world state.
+	uint32_t ServerTime = 0;
+
+	// The world state slot holding the decoded world state, which must be handed back once it has been used, and
+	// whether the velocities in it are filled in.
+	uint32_t Slot = 0;
+	bool HasVelocity = false;
+
+	// The pong. When the ping was sent on our own clock, and when it was received and answered on the server's.
+	double PingSent = 0.0;
+	uint32_t ServerReceived = 0;
+	uint32_t ServerSent = 0;
+};
+
+// The state of the connection, as seen by the network thread.
+enum class ConnectionState : uint8_t
+{
+	Disconnected,
+
+	// Waiting for the server to accept our connection.
+	Connecting,
+
+	// Waiting to try connecting again after an attempt failed or the connection was lost.
+	WaitingToRetry,
+
+	Connected,
+
+	// Waiting for the server to acknowledge that we are disconnecting.
+	Disconnecting
+};
+
+// Commands passed from the game thread to the network thread.
+enum class NetworkCommandType : uint8_t
+{
+	Connect,
+	Disconnect,
+
+	// Send a packet to the server.
+	Send
+};
+
+struct NetworkCommand
+{
+	NetworkCommandType Type = NetworkCommandType::Send;
+	ENetPacket* Packet = nullptr;
+	PacketChannel Channel = PacketChannel::Events;
+};
+
+// Runs the connection to the server on its own thread, so the game thread never waits on the socket and a slow
+// frame never holds up the network.
+//
+// The network thread owns the ENet host. It services it at a steady rate, decodes world states against its own
+// history of them and acknowledges them straight away, and keeps pinging the server for clock synchronization.
+// Everything the game needs to know about is passed over as events through a lock-free queue, and the game passes
+// packets and connection requests back the same way. Decoded world states are handed over in a fixed set of slots
+// which the game thread returns once it is done with them, so nothing is allocated once they have warmed up. If the
+// game thread falls so far behind that every slot is taken, world states are still acknowledged but the game does
+// not see them.
+//
+// Connecting and disconnecting never block either. The connection moves through ConnectionState as the network
+// thread goes round its loop, giving up on an attempt to connect after ConnectionTimeout, and on a graceful
+// disconnect after DisconnectTimeout. Failed attempts, and connections which are lost, are retried with
+// exponential backoff until the game asks us to disconnect. The delay is randomized a little, so that clients
+// which lost the server at the same time do not all come back at once.
+class ClientNetwork
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr auto ServerAddress = "127.0.0.1";
+
+	// How long to wait for the server to accept a connection, or to acknowledge a disconnect, in seconds.
+	static constexpr double ConnectionTimeout = 0.8;
+	static constexpr double DisconnectTimeout = 0.8;
+
+	// How long to wait before trying to connect again, in seconds. The delay doubles with each attempt up to the
+	// maximum, and is then moved up or down by up to the jitter, as a fraction of it.
+	static constexpr double InitialRetryDelay = 0.5;
+	static constexpr double MaxRetryDelay = 8.0;
+	static constexpr double RetryJitter = 0.25;
+
+	// How long the network thread will block on the socket before checking for outgoing packets, in milliseconds.
+	static constexpr auto PollTimeout = 1;
+
+	// The maximum number of ENet events handled before the network thread goes back to sending.
+	static constexpr auto MaxEventsPerPoll = 256;
+
+	// How many world states are kept around to decode deltas against. This should match the server.
+	static constexpr auto SnapshotHistorySize = 32;
+
+	// How many decoded world states can be waiting for the game thread at once.
+	static constexpr uint32_t WorldStateSlotCount = 16;
+
+	// How often the server is pinged to keep our clock in step with it, in seconds.
+	static constexpr double PingInterval = 0.25;
+private:
+	Clock::time_point m_StartTime = Clock::now();
+
+	// Must match the server.
+	CompressionSettings m_Compression;
+
+	std::thread m_Thread;
+	std::atomic<bool> m_Running = false;
+
+	SpscQueue<NetworkEvent, 256> m_Events;
+	SpscQueue<NetworkCommand, 256> m_Commands;
+
+	// Decoded world states on their way to the game thread, and the slots it has handed back.
+	std::array<Snapshot, WorldStateSlotCount> m_WorldStates;
+	SpscQueue<uint32_t, WorldStateSlotCount> m_FreeWorldStates;
+
+	// A slot the network thread took but could not pass on, which it uses next instead of taking another.
+	uint32_t m_HeldWorldState = WorldStateSlotCount;
+
+	// The round trip time to the server in milliseconds, for display.
+	std::atomic<uint32_t> m_RoundTripTime = 0;
+
+	// Packets are encoded into buffers from here by the game thread.
+	PacketPool m_Packets;
+
+	// The following are owned by the network thread.
+	ENetHost* m_Client = nullptr;
+	ENetPeer* m_Peer = nullptr;
+	ConnectionState m_State = ConnectionState::Disconnected;
+	bool m_Welcomed = false;
+
+	// When the current state times out, or when to try connecting again, on our own clock.
+	double m_Deadline = 0.0;
+	uint32_t m_Attempt = 0;
+	double m_RetryDelay = InitialRetryDelay;
+	std::minstd_rand m_Random{ static_cast<uint32_t>(Clock::now().time_since_epoch().count()) };
+
+	double m_LastPingTime = 0.0;
+
+	// For the packets the network thread sends itself, acks and pings.
+	PacketPool m_ReplyPackets;
+	PacketDecoder<WelcomePacket, WorldStateView, PongPacket> m_Decoder;
+
+	// The world states received from the server, which later world states are delta compressed against.
+	SnapshotHistory<SnapshotHistorySize> m_Snapshots;
+	Snapshot m_DecodedSnapshot;
+	uint32_t m_LatestSnapshot = 0;
+	bool m_HasSnapshot = false;
+public:
+	explicit ClientNetwork(const CompressionSettings& compression)
+		: m_Compression(compression)
+	{
+		for (uint32_t i = 0; i < WorldStateSlotCount; i++)
+		{
+			m_FreeWorldStates.Push(i);
+		}
+	}
+
+	ClientNetwork(const ClientNetwork&) = delete;
+	ClientNetwork& operator=(const ClientNetwork&) = delete;
+
+	~ClientNetwork()
+	{
+		Stop();
+	}
+
+	void Start()
+	{
+		if (m_Running) { return; }
+
+		m_Running = true;
+		m_Thread = std::thread([this] { Run(); });
+	}
+
+	// Disconnects from the server, if connected, and waits for the network thread to finish. This can take up to
+	// DisconnectTimeout.
+	void Stop()
+	{
+		if (!m_Running) { return; }
+
+		m_Running = false;
+		m_Thread.join();
+	}
+
+	// Our own clock, in seconds. Shared by both threads.
+	double GetLocalTime() const
+	{
+		return std::chrono::duration<double>(Clock::now() - m_StartTime).count();
+	}
+
+	// The following are called from the game thread.
+
+	void Connect() { QueueCommand({ NetworkCommandType::Connect }); }
+	void Disconnect() { QueueCommand({ NetworkCommandType::Disconnect }); }
+
+	// Encodes a packet and queues it to be sent. Packets are dropped if the queue is full.
+	template<typename T>
+	void Send(const T& packet)
+	{
+		auto delivery = GetDelivery(T::ID);
+
+		NetworkCommand command;
+		command.Type = NetworkCommandType::Send;
+		command.Packet = m_Packets.Encode(packet, delivery.Flags);
+		command.Channel = delivery.Channel;
+		if (command.Packet == nullptr) { return; }
+
+		QueueCommand(command);
+	}
+
+	// Removes the oldest event the network thread has passed on. Returns false if there are none.
+	bool PollEvent(NetworkEvent& event) { return m_Events.Pop(event); }
+
+	const Snapshot& GetWorldState(uint32_t slot) const { return m_WorldStates[slot]; }
+
+	// Hands a world state slot back once the game is done with it.
+	void ReleaseWorldState(uint32_t slot) { m_FreeWorldStates.Push(slot); }
+
+	uint32_t GetRoundTripTime() const { return m_RoundTripTime.load(std::memory_order_relaxed); }
+private:
+	// Connection requests must never be lost, so we wait for room in the queue. Packets are dropped instead.
+	void QueueCommand(const NetworkCommand& command)
+	{
+		if (command.Type != NetworkCommandType::Send)
+		{
+			while (!m_Commands.Push(command))
+			{
+				std::this_thread::yield();
+			}
+			return;
+		}
+
+		if (!m_Commands.Push(command))
+		{
+			enet_packet_destroy(command.Packet);
+		}
+	}
+
+	// Connection events must never be lost either, so we wait for room in the queue. Anything else is dropped
+	// rather than holding up the network thread for a game thread which has stalled. Returns false if the event
+	// was dropped.
+	bool PushEvent(const NetworkEvent& event)
+	{
+		bool mustArrive = event.Type != NetworkEventType::WorldState && event.Type != NetworkEventType::Pong;
+		if (!mustArrive) { return m_Events.Push(event); }
+
+		while (!m_Events.Push(event) && m_Running)
+		{
+			std::this_thread::yield();
+		}
+		return true;
+	}
+
+	// Our own clock as sent in pings, microseconds in 32 bits.
+	static uint32_t ToPingTime(double localTime)
+	{
+		return static_cast<uint32_t>(static_cast<uint64_t>(localTime * 1e6));
+	}
+
+	// The following are run on the network thread.
+
+	void Run()
+	{
+		// Once we have been asked to stop, we keep going until we have disconnected.
+		while (m_Running || m_State != ConnectionState::Disconnected)
+		{
+			if (!m_Running) { BeginDisconnect(); }
+
+			ProcessCommands();
+
+			if (m_State == ConnectionState::WaitingToRetry && GetLocalTime() >= m_Deadline)
+			{
+				BeginConnect();
+			}
+
+			if (m_State == ConnectionState::Disconnected || m_State == ConnectionState::WaitingToRetry)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(PollTimeout));
+				continue;
+			}
+
+			// Block on the socket until something arrives or the poll timeout expires, then handle everything
+			// else which is already waiting without blocking again. Handling an event can destroy the host.
+			ENetEvent event;
+			int result = enet_host_service(m_Client, &event, PollTimeout);
+			for (int i = 0; result > 0 && i < MaxEventsPerPoll; i++)
+			{
+				HandleEvent(event);
+				result = m_Client != nullptr ? enet_host_service(m_Client, &event, 0) : 0;
+			}
+
+			double now = GetLocalTime();
+			if (m_State == ConnectionState::Connecting && now >= m_Deadline)
+			{
+				std::cout << "Failed to connect to server." << std::endl;
+				enet_peer_reset(m_Peer);
+				DestroyHost();
+				ScheduleRetry();
+			}
+			else if (m_State == ConnectionState::Disconnecting && now >= m_Deadline)
+			{
+				std::cout << "Forcefully disconnect from server." << std::endl;
+				enet_peer_reset(m_Peer);
+				FinishDisconnect();
+			}
+			else if (m_State == ConnectionState::Connected)
+			{
+				if (m_Welcomed && now - m_LastPingTime >= PingInterval)
+				{
+					PingPacket ping;
+					ping.ClientTime = ToPingTime(now);
+					SendPacket(ping);
+					m_LastPingTime = now;
+				}
+
+				m_RoundTripTime.store(enet_peer_get_rtt(m_Peer), std::memory_order_relaxed);
+			}
+
+			if (m_Client != nullptr) { enet_host_flush(m_Client); }
+		}
+
+		// Packets which were never sent still belong to the game threads pool.
+		NetworkCommand command;
+		while (m_Commands.Pop(command))
+		{
+			if (command.Packet != nullptr) { enet_packet_destroy(command.Packet); }
+		}
+	}
+
+	void ProcessCommands()
+	{
+		NetworkCommand command;
+		while (m_Commands.Pop(command))
+		{
+			switch (command.Type)
+			{
+			case NetworkCommandType::Connect: {
+				// Asking again while waiting to retry skips the rest of the wait.
+				if (!m_Running) { break; }
+				if (m_State == ConnectionState::Disconnected)
+				{
+					m_Attempt = 0;
+					m_RetryDelay = InitialRetryDelay;
+					BeginConnect();
+				}
+				else if (m_State == ConnectionState::WaitingToRetry)
+				{
+					BeginConnect();
+				}
+			} break;
+			case NetworkCommandType::Disconnect: {
+				BeginDisconnect();
+			} break;
+			case NetworkCommandType::Send: {
+				if (m_State != ConnectionState::Connected || enet_peer_send(m_Peer, static_cast<uint8_t>(command.Channel), command.Packet) != 0)
+				{
+					enet_packet_destroy(command.Packet);
+				}
+			} break;
+			}
+		}
+	}
+
+	// Starts an attempt to connect, which HandleEvent or Run will finish.
+	void BeginConnect()
+	{
+		m_Snapshots = {};
+		m_HasSnapshot = false;
+		m_Welcomed = false;
+		m_Attempt++;
+
+		NetworkEvent connecting;
+		connecting.Type = NetworkEventType::Connecting;
+		connecting.Attempt = m_Attempt;
+		PushEvent(connecting);
+
+		m_Client = enet_host_create(nullptr, 1, ChannelCount, 0, 0);
+		if (m_Client == nullptr)
+		{
+			std::cout << "Failed to create ENet host." << std::endl;
+			ScheduleRetry();
+			return;
+		}
+
+		EnableCompression(m_Client, m_Compression);
+
+		std::cout << "Attempting to connect to " << ServerAddress << ":" << Config::Port << "." << std::endl;
+
+		ENetAddress address = { 0 };
+		enet_address_set_host(&address, ServerAddress);
+		address.port = Config::Port;
+
+		m_Peer = enet_host_connect(m_Client, &address, ChannelCount, 0);
+		if (m_Peer == nullptr)
+		{
+			std::cout << "Failed to initiate connection to peer." << std::endl;
+			DestroyHost();
+			ScheduleRetry();
+			return;
+		}
+
+		m_State = ConnectionState::Connecting;
+		m_Deadline = GetLocalTime() + ConnectionTimeout;
+	}
+
+	// Waits a while before trying to connect again, backing off further each time.
+	void ScheduleRetry()
+	{
+		std::uniform_real_distribution<double> jitter(1.0 - RetryJitter, 1.0 + RetryJitter);
+		double delay = m_RetryDelay * jitter(m_Random);
+		m_RetryDelay = std::min(m_RetryDelay * 2.0, MaxRetryDelay);
+
+		m_State = ConnectionState::WaitingToRetry;
+		m_Deadline = GetLocalTime() + delay;
+
+		NetworkEvent retrying;
+		retrying.Type = NetworkEventType::Retrying;
+		retrying.Attempt = m_Attempt;
+		retrying.RetryDelay = delay;
+		PushEvent(retrying);
+	}
+
+	// Starts disconnecting from the server, or gives up on connecting to it.
+	void BeginDisconnect()
+	{
+		switch (m_State)
+		{
+		case ConnectionState::Connected: {
+			enet_peer_disconnect(m_Peer, 0);
+			m_State = ConnectionState::Disconnecting;
+			m_Deadline = GetLocalTime() + DisconnectTimeout;
+		} break;
+		case ConnectionState::Connecting: {
+			enet_peer_reset(m_Peer);
+			FinishDisconnect();
+		} break;
+		case ConnectionState::WaitingToRetry: {
+			FinishDisconnect();
+		} break;
+		default: break;
+		}
+	}
+
+	void FinishDisconnect()
+	{
+		DestroyHost();
+		m_State = ConnectionState::Disconnected;
+		PushEvent({ NetworkEventType::Disconnected });
+	}
+
+	void DestroyHost()
+	{
+		if (m_Client != nullptr) { enet_host_destroy(m_Client); }
+		m_Client = nullptr;
+		m_Peer = nullptr;
+		m_RoundTripTime.store(0, std::memory_order_relaxed);
+	}
+
+	void HandleEvent(ENetEvent& event)
+	{
+		switch (event.type)
+		{
+		case ENET_EVENT_TYPE_CONNECT: {
+			if (m_State != ConnectionState::Connecting) { break; }
+
+			std::cout << "Connected to server." << std::endl;
+			m_State = ConnectionState::Connected;
+			m_Attempt = 0;
+			m_RetryDelay = InitialRetryDelay;
+			PushEvent({ NetworkEventType::Connected });
+		} break;
+		case ENET_EVENT_TYPE_DISCONNECT: case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT: {
+			if (m_State == ConnectionState::Disconnecting)
+			{
+				std::cout << "Gracefully disconnect from server." << std::endl;
+				FinishDisconnect();
+			}
+			else if (m_State == ConnectionState::Connecting)
+			{
+				// The server turned us away.
+				std::cout << "Failed to connect to server." << std::endl;
+				DestroyHost();
+				ScheduleRetry();
+			}
+			else if (m_State == ConnectionState::Connected)
+			{
+				std::cout << (event.type == ENET_EVENT_TYPE_DISCONNECT ? "ENET_EVENT_TYPE_DISCONNECT" : "ENET_EVENT_TYPE_DISCONNECT_TIMEOUT") << std::endl;
+				DestroyHost();
+				PushEvent({ NetworkEventType::Disconnected });
+				ScheduleRetry();
+			}
+		} break;
+		case ENET_EVENT_TYPE_RECEIVE: {
+			// Anything which arrives while we are disconnecting is of no use any more.
+			if (m_State != ConnectionState::Connected)
+			{
+				enet_packet_destroy(event.packet);
+				break;
+			}
+
+			// Read the packet from the buffer and handle it. Packets which are cut short, or which the server
+			// has no business sending, are dropped.
+			double received = GetLocalTime();
+			BitReader reader(event.packet->data, event.packet->dataLength);
+			m_Decoder.Decode(reader, [&](const auto& packet) { HandlePacket(packet, received); });
+
+			enet_packet_destroy(event.packet);
+		} break;
+		}
+	}
+
+	template<typename T>
+	void SendPacket(const T& packet)
+	{
+		auto delivery = GetDelivery(T::ID);
+		ENetPacket* enetPacket = m_ReplyPackets.Encode(packet, delivery.Flags);
+		if (enetPacket == nullptr) { return; }
+
+		if (enet_peer_send(m_Peer, static_cast<uint8_t>(delivery.Channel), enetPacket) != 0)
+		{
+			enet_packet_destroy(enetPacket);
+		}
+	}
+
+	void HandlePacket(const WelcomePacket& packet, double received)
+	{
+		m_Welcomed = true;
+
+		NetworkEvent event;
+		event.Type = NetworkEventType::Welcome;
+		event.Received = received;
+		event.ClientID = packet.ClientID;
+		event.Tick = packet.Tick;
+		event.ServerTime = packet.ServerTime;
+		event.SnapshotRate = packet.SnapshotRate;
+		PushEvent(event);
+	}
+
+	void HandlePacket(const WorldStateView& packet, double received)
+	{
+		// World states are not ordered with the welcome, so one can turn up before we know which entity is ours.
+		if (!m_Welcomed) { return; }
+
+		// Ignore anything older than what we already have. ENet drops most of these, but not those from before
+		// a reconnect.
+		if (m_HasSnapshot && !IsSequenceNewer(packet.Sequence, m_LatestSnapshot)) { return; }
+
+		// We can't decode a delta without its baseline. The server will send a keyframe once it notices we
+		// have stopped acknowledging.
+		const Snapshot* baseline = nullptr;
+		if (!packet.IsKeyframe())
+		{
+			baseline = m_Snapshots.Find(packet.BaselineSequence);
+			if (baseline == nullptr) { return; }
+		}
+
+		// Rebuild the full world state and store it, so it can be used as a baseline. The changes are read
+		// straight out of the packet as they are applied, so it is only known to be intact once this succeeds.
+		if (!ApplyDelta(baseline, packet, m_DecodedSnapshot)) { return; }
+
+		auto& snapshot = m_Snapshots.Push(packet.Sequence);
+		std::swap(snapshot.Entries, m_DecodedSnapshot.Entries);
+		m_LatestSnapshot = packet.Sequence;
+		m_HasSnapshot = true;
+
+		SnapshotAckPacket ack;
+		ack.Sequence = packet.Sequence;
+		SendPacket(ack);
+
+		// Pass a copy on to the game thread. The copy reuses the memory of the last world state in the slot.
+		uint32_t slot = m_HeldWorldState;
+		if (slot == WorldStateSlotCount && !m_FreeWorldStates.Pop(slot)) { return; }
+		m_HeldWorldState = WorldStateSlotCount;
+
+		m_WorldStates[slot].Sequence = snapshot.Sequence;
+		m_WorldStates[slot].Valid = true;
+		m_WorldStates[slot].Entries = snapshot.Entries;
+
+		NetworkEvent event;
+		event.Type = NetworkEventType::WorldState;
+		event.Received = received;
+		event.ServerTime = packet.ServerTime;
+		event.Slot = slot;
+		event.HasVelocity = packet.HasVelocity;
+		if (!PushEvent(event)) { m_HeldWorldState = slot; }
+	}
+
+	void HandlePacket(const PongPacket& packet, double received)
+	{
+		// Our send time only went round trip, so it is read relative to when the pong arrived.
+		NetworkEvent event;
+		event.Type = NetworkEventType::Pong;
+		event.Received = received;
+		event.PingSent = received - (ToPingTime(received) - packet.ClientTime) / 1e6;
+		event.ServerReceived = packet.ReceiveTime;
+		event.ServerSent = packet.SendTime;
+		PushEvent(event);
+	}
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Estimates the server timeline from our own clock, so that interpolation and prediction can follow the server's
+// ticks rather than whenever its packets happen to arrive.
+//
+// Works like NTP. Each ping gives four times: when we sent it, when the server received it, when the server
+// answered and when the answer arrived. Assuming the trip took as long each way, these give the offset between the
+// clocks and the round trip delay. A sample can be off by at most half its delay, and queueing only ever adds
+// delay, so the sample with the least delay out of the last few is trusted the most. The drift between the clocks
+// is fitted over the most trusted samples of a longer window.
+//
+// The offset in use is slewed towards the estimate gradually, so the server time we give out never jumps, unless
+// it is off by so much that stepping is the lesser evil.
+class ClockSync
+{
+public:
+	// How many of the latest samples the offset is picked from.
+	static constexpr uint32_t FilterSize = 8;
+
+	// How many samples the drift is fitted over, about a minute of pings.
+	static constexpr uint32_t WindowSize = 256;
+
+	// The drift is only fitted once the samples cover this much time, in seconds.
+	static constexpr double MinDriftSpan = 10.0;
+
+	// How fast the offset in use may be slewed, in seconds per second.
+	static constexpr double MaxSlewRate = 0.005;
+
+	// Errors larger than this are stepped over rather than slewed, in seconds.
+	static constexpr double StepThreshold = 0.128;
+
+	// How quickly our confidence in the offset fades as the best sample ages, in seconds per second, as in NTP.
+	static constexpr double DispersionRate = 15e-6;
+private:
+	struct Sample
+	{
+		double LocalTime;
+		double Offset;
+		double Delay;
+	};
+
+	std::array<Sample, WindowSize> m_Samples;
+	uint32_t m_Count = 0;
+	uint32_t m_Next = 0;
+
+	// The best sample of the last few, and the drift from it.
+	Sample m_Best = {};
+	double m_Drift = 0.0;
+	bool m_HasSample = false;
+
+	// The offset in use, and the local time it was last updated. Until the first sample has been used it is only
+	// a guess, and is stepped straight to the first estimate.
+	double m_Offset = 0.0;
+	double m_LastUpdate = 0.0;
+	bool m_Synchronized = false;
+
+	// The newest server time seen, in microseconds, for reading times which have wrapped around.
+	uint64_t m_LatestServerTime = 0;
+
+	const Sample& GetSample(uint32_t age) const { return m_Samples[(m_Next + WindowSize - 1 - age) % WindowSize]; }
+
+	// The sample with the least delay out of FilterSize samples, starting from the given age.
+	const Sample& GetBestSample(uint32_t age) const
+	{
+		const Sample* best = &GetSample(age);
+		for (uint32_t i = age + 1; i < std::min(m_Count, age + FilterSize); i++)
+		{
+			if (GetSample(i).Delay < best->Delay) { best = &GetSample(i); }
+		}
+		return *best;
+	}
+
+	// Least squares over the best sample of each run of FilterSize samples, whose offsets can be trusted.
+	void FitDrift()
+	{
+		double n = 0, sumT = 0, sumO = 0, sumTT = 0, sumTO = 0, first = INFINITY, last = -INFINITY;
+		for (uint32_t age = 0; age < m_Count; age += FilterSize)
+		{
+			const Sample& sample = GetBestSample(age);
+			double t = sample.LocalTime - m_Best.LocalTime;
+			n++;
+			sumT += t;
+			sumO += sample.Offset;
+			sumTT += t * t;
+			sumTO += t * sample.Offset;
+			first = std::min(first, t);
+			last = std::max(last, t);
+		}
+
+		double denominator = n * sumTT - sumT * sumT;
+		m_Drift = n >= 4 && last - first >= MinDriftSpan && denominator > 0.0 ? (n * sumTO - sumT * sumO) / denominator : 0.0;
+	}
+public:
+	// Starts out from a single server time, such as the one in the welcome. This takes no account of how long it
+	// took to arrive, so it is only good until the first ping comes back.
+	void Start(uint32_t serverTime, double localTime)
+	{
+		*this = ClockSync();
+		m_LatestServerTime = serverTime;
+		m_Offset = serverTime / 1e6 - localTime;
+		m_LastUpdate = localTime;
+	}
+
+	// Adds the result of a ping. The server times must already be on the server timeline, see ReadServerTime.
+	void AddSample(double sent, double serverReceived, double serverSent, double received)
+	{
+		Sample sample;
+		sample.LocalTime = received;
+		sample.Offset = ((serverReceived - sent) + (serverSent - received)) / 2.0;
+		sample.Delay = std::max((received - sent) - (serverSent - serverReceived), 0.0);
+
+		m_Samples[m_Next] = sample;
+		m_Next = (m_Next + 1) % WindowSize;
+		m_Count = std::min(m_Count + 1, WindowSize);
+
+		m_Best = GetBestSample(0);
+		m_HasSample = true;
+
+		FitDrift();
+	}
+
+	// The best estimate of the offset at the given local time, which may jump as samples come in.
+	double EstimateOffset(double localTime) const
+	{
+		if (!m_HasSample) { return m_Offset; }
+		return m_Best.Offset + m_Drift * (localTime - m_Best.LocalTime);
+	}
+
+	// Moves the offset in use towards the estimate. Should be called once a frame. Returns true if the offset
+	// was stepped rather than slewed.
+	bool Update(double localTime)
+	{
+		double elapsed = std::max(localTime - m_LastUpdate, 0.0);
+		m_LastUpdate = localTime;
+		if (!m_HasSample) { return false; }
+
+		double error = EstimateOffset(localTime) - m_Offset;
+		if (!m_Synchronized || std::abs(error) > StepThreshold)
+		{
+			m_Offset += error;
+			m_Synchronized = true;
+			return true;
+		}
+
+		double step = MaxSlewRate * elapsed;
+		m_Offset += std::clamp(error, -step, step);
+		return false;
+	}
+
+	// The server time at the given local time, in seconds.
+	double GetServerTime(double localTime) const { return localTime + m_Offset; }
+
+	// Reads a server time from a packet, picking the wrap around which is closest to the newest time seen.
+	double ReadServerTime(uint32_t serverTime)
+	{
+		int32_t difference = static_cast<int32_t>(serverTime - static_cast<uint32_t>(m_LatestServerTime));
+		uint64_t time = m_LatestServerTime + difference;
+		m_LatestServerTime = std::max(m_LatestServerTime, time);
+		return time / 1e6;
+	}
+
+	// How far off the server time we give out could be, in seconds. This is half the delay of the best sample,
+	// which grows as the sample ages, plus however far the offset in use still has to slew.
+	double GetError(double localTime) const
+	{
+		if (!m_HasSample) { return INFINITY; }
+
+		double age = std::max(localTime - m_Best.LocalTime, 0.0);
+		return m_Best.Delay / 2.0 + DispersionRate * age + std::abs(EstimateOffset(localTime) - m_Offset);
+	}
+
+	double GetDrift() const { return m_Drift; }
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "SharedConfig.h"
+
+// Decides how far in the past other entities are drawn, so that there is always a newer world state to
+// interpolate towards.
+//
+// Positions are stamped with the server time of the tick they were taken on, and drawn at the current server
+// time less the delay. Each world state arrives some time after its tick, and the network makes that time vary.
+// Like the jitter buffer of a voice call, we measure how late world states are on average and how much that
+// varies, and draw far enough behind to cover it: the average lateness, plus the interval until the next world
+// state, plus a couple of times the jitter. A steady connection gets about one interval on top of its latency,
+// and a jittery one gets as much as it needs to rarely run dry.
+//
+// The delay only ever changes gradually, so entities speed up or slow down a little rather than jumping when it
+// does.
+class InterpolationDelay
+{
+public:
+	// How many times the average jitter is added on top of the lateness and the interval. The odd late world state is
+	// covered by extrapolating, so this only has to make running dry rare rather than stop it altogether.
+	static constexpr float JitterMultiplier = 2.0f;
+
+	// How quickly the lateness and jitter estimates follow new measurements, as in RTP (RFC 3550).
+	static constexpr float JitterGain = 1.0f / 16.0f;
+
+	// How much the delay can change for each second that passes.
+	static constexpr float MaxChangeRate = 0.1f;
+
+	static constexpr float MaxDelay = 0.5f;
+private:
+	// The longest time between world states, which is a tick unless the server sends them less often.
+	float m_Interval;
+	float m_Delay;
+	float m_Lateness = 0.0f;
+	float m_Jitter = 0.0f;
+	bool m_HasArrival = false;
+
+	// How many frames the interpolation has run dry in, for instrumentation.
+	uint32_t m_Underruns = 0;
+public:
+	explicit InterpolationDelay(float interval)
+		: m_Interval(interval), m_Delay(interval)
+	{
+	}
+
+	// Returns the longest time between world states when the server sends the given number a second. They go out on
+	// the ticks which spread them most evenly, so unless the rate divides the tick rate some are a tick further apart
+	// than the average, and the delay has to cover those too.
+	static float GetInterval(uint32_t snapshotRate)
+	{
+		uint32_t rate = std::clamp(snapshotRate, 1u, static_cast<uint32_t>(Config::ServerTimestep));
+		uint32_t ticks = (Config::ServerTimestep + rate - 1) / rate;
+		return static_cast<float>(ticks) / Config::ServerTimestep;
+	}
+
+	// Should be called whenever a world state arrives, with the server time of its tick and the current server time.
+	void OnArrival(double tickTime, double serverTime)
+	{
+		float lateness = static_cast<float>(serverTime - tickTime);
+		if (!m_HasArrival)
+		{
+			// Nothing has been drawn yet, so the delay can start out wherever it needs to be.
+			m_Lateness = lateness;
+			m_Delay = std::min(m_Lateness + m_Interval, MaxDelay);
+			m_HasArrival = true;
+			return;
+		}
+
+		m_Jitter += (std::abs(lateness - m_Lateness) - m_Jitter) * JitterGain;
+		m_Lateness += (lateness - m_Lateness) * JitterGain;
+	}
+
+	// Should be called for each frame in which an entity was drawn past its newest position.
+	void OnUnderrun() { m_Underruns++; }
+
+	// Moves the delay towards the one the measured lateness and jitter call for. Returns the delay to use this frame.
+	float Update(float dt)
+	{
+		float target = std::clamp(m_Lateness + m_Interval + JitterMultiplier * m_Jitter, 0.0f, MaxDelay);
+		float step = MaxChangeRate * dt;
+		m_Delay = std::clamp(target, m_Delay - step, m_Delay + step);
+		return m_Delay;
+	}
+
+	float GetDelay() const { return m_Delay; }
+	float GetLateness() const { return m_Lateness; }
+	float GetJitter() const { return m_Jitter; }
+	uint32_t GetUnderruns() const { return m_Underruns; }
+
+	// Should be called when the clock has been stepped, as the lateness measured so far no longer holds.
+	void Resynchronize() { m_HasArrival = false; }
+
+	void Reset()
+	{
+		*this = InterpolationDelay(m_Interval);
+	}
+};
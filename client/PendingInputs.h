@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+#include "Entity.h"
+
+// Holds the inputs which have been sent to the server but not applied by it yet, oldest first, so they can be
+// replayed on top of every position the server sends us.
+//
+// Inputs are numbered one after the other, so they live in a ring buffer indexed by sequence number and
+// acknowledging any number of them only moves the start along. Nothing is ever dropped to make room: if the
+// server stops acknowledging for long enough to fill the buffer, the player has to stop until it catches up.
+// Dropping inputs instead would leave the prediction wrong for good.
+//
+// Movement is a plain sum of displacements, so alongside each input we keep the running total of every
+// displacement up to and including it. Whatever the server acknowledges, the distance the inputs it has not
+// applied yet will still move us is the newest total less the total at the last input it did apply, without
+// going through them.
+class PendingInputs
+{
+public:
+	// Enough for a second of round trip at 1000 frames per second.
+	static constexpr uint32_t Capacity = 1024;
+	static_assert((Capacity & (Capacity - 1)) == 0, "PendingInputs capacity must be a power of two.");
+private:
+	static constexpr uint32_t Mask = Capacity - 1;
+
+	std::array<InputSnapshot, Capacity> m_Inputs;
+	uint32_t m_First = 0;
+	uint32_t m_Count = 0;
+
+	// The running total of displacements up to and including each input, and up to the last input acknowledged.
+	// Doubles, so that they stay exact for as long as the game runs.
+	std::array<double, Capacity> m_TotalX;
+	std::array<double, Capacity> m_TotalY;
+	double m_LatestTotalX = 0.0;
+	double m_LatestTotalY = 0.0;
+	double m_AcknowledgedTotalX = 0.0;
+	double m_AcknowledgedTotalY = 0.0;
+public:
+	bool IsFull() const { return m_Count == Capacity; }
+	uint32_t GetCount() const { return m_Count; }
+
+	// Adds an input, which must follow on from the last one added. The buffer must not be full.
+	void Push(const InputSnapshot& input)
+	{
+		assert(!IsFull());
+		assert(m_Count == 0 || input.SequenceNumber == m_First + m_Count);
+
+		float dx, dy;
+		EntityStore::GetDisplacement(input, dx, dy);
+		m_LatestTotalX += dx;
+		m_LatestTotalY += dy;
+
+		if (m_Count == 0) { m_First = input.SequenceNumber; }
+		uint32_t i = (m_First + m_Count) & Mask;
+		m_Inputs[i] = input;
+		m_TotalX[i] = m_LatestTotalX;
+		m_TotalY[i] = m_LatestTotalY;
+		m_Count++;
+	}
+
+	// Drops every input up to and including the given sequence number.
+	void Acknowledge(uint32_t sequence)
+	{
+		int32_t acknowledged = static_cast<int32_t>(sequence - m_First) + 1;
+		if (acknowledged <= 0) { return; }
+
+		uint32_t count = std::min(static_cast<uint32_t>(acknowledged), m_Count);
+		if (count == 0) { return; }
+
+		uint32_t last = (m_First + count - 1) & Mask;
+		m_AcknowledgedTotalX = m_TotalX[last];
+		m_AcknowledgedTotalY = m_TotalY[last];
+		m_First += count;
+		m_Count -= count;
+	}
+
+	// Returns how far the inputs which have not been acknowledged move an entity, all together.
+	void GetPendingDisplacement(float& dx, float& dy) const
+	{
+		dx = static_cast<float>(m_LatestTotalX - m_AcknowledgedTotalX);
+		dy = static_cast<float>(m_LatestTotalY - m_AcknowledgedTotalY);
+	}
+
+	// Returns the input `i` places after the oldest.
+	const InputSnapshot& Get(uint32_t i) const
+	{
+		assert(i < m_Count);
+		return m_Inputs[(m_First + i) & Mask];
+	}
+
+	void Clear()
+	{
+		m_Count = 0;
+		m_LatestTotalX = m_LatestTotalY = 0.0;
+		m_AcknowledgedTotalX = m_AcknowledgedTotalY = 0.0;
+	}
+};
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cassert>
+
+#include "SharedConfig.h"
+
+struct EntityPosition
+{
+	// When the position was taken, on the server timeline.
+	double Timestamp = 0;
+	float X = 0;
+	float Y = 0;
+
+	// The velocity over the tick leading up to the position, if the server sent it.
+	float VelocityX = 0;
+	float VelocityY = 0;
+	bool HasVelocity = false;
+
+	EntityPosition() = default;
+	EntityPosition(const EntityPosition&) = default;
+
+	EntityPosition(double ts, float x, float y)
+		: Timestamp(ts), X(x), Y(y)
+	{
+	}
+
+	void SetVelocity(float vx, float vy)
+	{
+		VelocityX = vx;
+		VelocityY = vy;
+		HasVelocity = true;
+	}
+};
+
+// The recent positions of an entity, oldest first, which it is interpolated between.
+//
+// Positions which come with a velocity are joined by a curve rather than a straight line, which keeps movement
+// smooth when world states are more than a tick apart. The velocity is how far the entity moved over the tick
+// leading up to the position, so that last tick is known exactly and is a straight line. The rest of the way is
+// a cubic Hermite curve, leaving the older position at its velocity and arriving at the start of the last tick at
+// the newer one. World states a tick apart are joined by a straight line, as before. Positions without a velocity
+// are always joined by a straight line.
+//
+// Positions are kept in a fixed size ring buffer, so dropping the ones which are no longer needed only moves the
+// start along. If positions arrive faster than they are used up the oldest are overwritten.
+//
+// When a world state is late and the history runs dry, the entity carries on at the velocity between its newest
+// two positions for a little while, rather than stopping dead. Once a newer position arrives the entity is put
+// back on its path, but whatever the guess was off by is blended away over a short time rather than jumped.
+class PositionHistory
+{
+public:
+	// Enough for over a second of world states, more than the interpolation delay ever gets to.
+	static constexpr uint32_t Capacity = 32;
+	static_assert((Capacity & (Capacity - 1)) == 0, "PositionHistory capacity must be a power of two.");
+
+	// How far past the newest position an entity is carried along, in seconds. After that it waits where it is.
+	static constexpr double MaxExtrapolation = 0.25;
+
+	// How quickly the error left by extrapolating is blended away, in seconds, unless it is so large that the
+	// entity must have been teleported.
+	static constexpr double BlendTime = 0.1;
+	static constexpr float MaxBlendError = 32.0f;
+
+	// How long the velocity of a position covers.
+	static constexpr double TickLength = 1.0 / Config::ServerTimestep;
+private:
+	static constexpr uint32_t Mask = Capacity - 1;
+
+	std::array<EntityPosition, Capacity> m_Positions;
+	uint32_t m_First = 0;
+	uint32_t m_Count = 0;
+
+	// The last position given out, when for and how fast it was moving, to work out how far off it was once a
+	// newer position arrives after extrapolating.
+	double m_LastTime = 0.0;
+	float m_LastX = 0.0f;
+	float m_LastY = 0.0f;
+	float m_LastVelocityX = 0.0f;
+	float m_LastVelocityY = 0.0f;
+	bool m_Extrapolating = false;
+	bool m_Resynchronize = false;
+
+	// How far from its path the entity is being drawn, while that is being blended away.
+	float m_ErrorX = 0.0f;
+	float m_ErrorY = 0.0f;
+
+	const EntityPosition& Get(uint32_t i) const { return m_Positions[(m_First + i) & Mask]; }
+
+	// The point a fraction t of the way along the curve from p0 to p1, leaving and arriving with the given
+	// tangents, which are velocities scaled to the length of the curve.
+	static float Hermite(float p0, float m0, float p1, float m1, float t)
+	{
+		float t2 = t * t;
+		float t3 = t2 * t;
+		return (2.0f * t3 - 3.0f * t2 + 1.0f) * p0 + (t3 - 2.0f * t2 + t) * m0 + (-2.0f * t3 + 3.0f * t2) * p1 + (t3 - t2) * m1;
+	}
+public:
+	bool IsEmpty() const { return m_Count == 0; }
+	uint32_t GetCount() const { return m_Count; }
+
+	// Adds a position, which must be newer than the others.
+	void Push(const EntityPosition& position)
+	{
+		if (m_Count == Capacity)
+		{
+			m_First++;
+			m_Count--;
+		}
+
+		m_Positions[(m_First + m_Count) & Mask] = position;
+		m_Count++;
+
+		m_Resynchronize |= m_Extrapolating;
+	}
+
+	// Finds the position at the given time, interpolating between the positions either side of it, and drops the
+	// positions before those which are no longer needed. Returns false if the time is past the newest position,
+	// which means the history has run dry and the position is extrapolated instead. The history must not be empty.
+	bool Sample(double time, float& x, float& y)
+	{
+		assert(!IsEmpty());
+
+		// The newest two positions are always kept, for their velocity.
+		while (m_Count >= 3 && Get(1).Timestamp <= time)
+		{
+			m_First++;
+			m_Count--;
+		}
+
+		float velocityX = 0.0f;
+		float velocityY = 0.0f;
+		bool inRange = true;
+
+		const EntityPosition& from = Get(0);
+		if (time <= from.Timestamp || m_Count == 1)
+		{
+			x = from.X;
+			y = from.Y;
+			inRange = time <= from.Timestamp;
+		}
+		else
+		{
+			const EntityPosition& to = Get(1);
+			double span = to.Timestamp - from.Timestamp;
+			velocityX = to.HasVelocity ? to.VelocityX : static_cast<float>((to.X - from.X) / span);
+			velocityY = to.HasVelocity ? to.VelocityY : static_cast<float>((to.Y - from.Y) / span);
+
+			if (time <= to.Timestamp && from.HasVelocity && to.HasVelocity)
+			{
+				double lastTick = std::max(to.Timestamp - TickLength, from.Timestamp);
+				if (time >= lastTick)
+				{
+					auto before = static_cast<float>(to.Timestamp - time);
+					x = to.X - to.VelocityX * before;
+					y = to.Y - to.VelocityY * before;
+				}
+				else
+				{
+					auto before = static_cast<float>(to.Timestamp - lastTick);
+					auto length = static_cast<float>(lastTick - from.Timestamp);
+					auto t = static_cast<float>((time - from.Timestamp) / (lastTick - from.Timestamp));
+					x = Hermite(from.X, from.VelocityX * length, to.X - to.VelocityX * before, to.VelocityX * length, t);
+					y = Hermite(from.Y, from.VelocityY * length, to.Y - to.VelocityY * before, to.VelocityY * length, t);
+				}
+			}
+			else if (time <= to.Timestamp)
+			{
+				float t = static_cast<float>((time - from.Timestamp) / span);
+				x = from.X + (to.X - from.X) * t;
+				y = from.Y + (to.Y - from.Y) * t;
+			}
+			else
+			{
+				// Carry on from the newest position for a while, then wait there.
+				float ahead = static_cast<float>(std::min(time - to.Timestamp, MaxExtrapolation));
+				x = to.X + velocityX * ahead;
+				y = to.Y + velocityY * ahead;
+				if (time - to.Timestamp >= MaxExtrapolation) { velocityX = velocityY = 0.0f; }
+				inRange = false;
+			}
+		}
+
+		double elapsed = std::max(time - m_LastTime, 0.0);
+		if (m_Resynchronize)
+		{
+			// Where we would have drawn the entity had nothing new arrived, less where it should be.
+			m_ErrorX = m_LastX + m_LastVelocityX * static_cast<float>(elapsed) - x;
+			m_ErrorY = m_LastY + m_LastVelocityY * static_cast<float>(elapsed) - y;
+			if (std::abs(m_ErrorX) > MaxBlendError || std::abs(m_ErrorY) > MaxBlendError)
+			{
+				m_ErrorX = m_ErrorY = 0.0f;
+			}
+			m_Resynchronize = false;
+		}
+		else
+		{
+			float decay = static_cast<float>(std::exp(-elapsed / BlendTime));
+			m_ErrorX *= decay;
+			m_ErrorY *= decay;
+		}
+
+		x += m_ErrorX;
+		y += m_ErrorY;
+
+		m_LastTime = time;
+		m_LastX = x;
+		m_LastY = y;
+		m_LastVelocityX = velocityX;
+		m_LastVelocityY = velocityY;
+		m_Extrapolating = !inRange;
+		return inRange;
+	}
+};
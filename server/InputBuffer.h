@@ -0,0 +1,149 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cstdint>
+
+#include "Entity.h"
+
+// Holds the inputs a client has sent which have not been applied yet, ordered by sequence number.
+//
+// Inputs are only released on tick boundaries, and each tick a client may only use up as much input time as
+// has actually passed on the server. A client can build up at most `depth` extra ticks of time, which lets it
+// catch up after inputs arrive in a burst, without letting it move faster than real time by claiming a large
+// delta time or flooding us with inputs.
+//
+// Clients only resend their newest Capacity inputs, so once an input arrives which is further ahead than that,
+// everything before its window is never going to turn up. The buffer moves along to fit it rather than turning
+// it away, which would leave the client stuck after any outage longer than the window.
+class InputBuffer
+{
+public:
+	static constexpr uint32_t Capacity = 128;
+
+	enum class AddResult
+	{
+		Added,
+
+		// The input is already in the buffer.
+		Duplicate,
+
+		// The input has already been applied or skipped.
+		TooOld
+	};
+private:
+	struct Slot
+	{
+		InputSnapshot Input;
+		bool Present = false;
+	};
+
+	std::array<Slot, Capacity> m_Slots;
+	uint32_t m_NextSequence = 0;
+	uint32_t m_Buffered = 0;
+	bool m_Started = false;
+
+	// The amount of input time the client is allowed to use up, in seconds.
+	float m_Budget = 0.0f;
+
+	// How many ticks we have been waiting on a missing input.
+	uint32_t m_StalledTicks = 0;
+
+	// How many inputs were given up on to make room for newer ones, since the last Consume.
+	uint32_t m_Skipped = 0;
+
+	// Gives up on every input before the given sequence number, whether it has arrived or not.
+	void SkipTo(uint32_t sequence)
+	{
+		uint32_t count = sequence - m_NextSequence;
+		if (count >= Capacity)
+		{
+			for (auto& slot : m_Slots) { slot.Present = false; }
+			m_Buffered = 0;
+		}
+		else
+		{
+			for (uint32_t i = m_NextSequence; i != sequence; i++)
+			{
+				Slot& slot = m_Slots[i % Capacity];
+				if (slot.Present)
+				{
+					slot.Present = false;
+					m_Buffered--;
+				}
+			}
+		}
+
+		m_Skipped += count;
+		m_NextSequence = sequence;
+		m_StalledTicks = 0;
+	}
+public:
+	AddResult Add(const InputSnapshot& input)
+	{
+		// The first input we see decides where the sequence starts.
+		if (!m_Started)
+		{
+			m_NextSequence = input.SequenceNumber;
+			m_Started = true;
+		}
+
+		int32_t offset = static_cast<int32_t>(input.SequenceNumber - m_NextSequence);
+		if (offset < 0) { return AddResult::TooOld; }
+		if (offset >= static_cast<int32_t>(Capacity)) { SkipTo(input.SequenceNumber - (Capacity - 1)); }
+
+		// Anything within the window maps to its own slot, so an occupied slot can only hold this same input.
+		Slot& slot = m_Slots[input.SequenceNumber % Capacity];
+		if (slot.Present) { return AddResult::Duplicate; }
+
+		slot.Input = input;
+		slot.Present = true;
+		m_Buffered++;
+		return AddResult::Added;
+	}
+
+	// Releases the inputs for a single tick, in sequence order, by calling apply on each of them.
+	// If an input is missing we wait up to `depth` ticks for it to turn up before skipping over it.
+	// Returns the number of inputs which were skipped, including those given up on by Add.
+	template<typename Apply>
+	uint32_t Consume(float tickLength, uint32_t depth, Apply&& apply)
+	{
+		const float maxBudget = tickLength * (depth + 1);
+		m_Budget = std::min(m_Budget + tickLength, maxBudget);
+
+		uint32_t skipped = m_Skipped;
+		m_Skipped = 0;
+		while (m_Buffered > 0)
+		{
+			Slot& slot = m_Slots[m_NextSequence % Capacity];
+			if (!slot.Present)
+			{
+				if (m_StalledTicks < depth)
+				{
+					m_StalledTicks++;
+					break;
+				}
+
+				m_NextSequence++;
+				skipped++;
+				continue;
+			}
+
+			// An input longer than the largest budget is let through once the budget is full, leaving the
+			// client in debt for the following ticks.
+			if (slot.Input.DeltaTime > m_Budget && m_Budget < maxBudget) { break; }
+
+			m_Budget -= slot.Input.DeltaTime;
+			apply(slot.Input);
+
+			slot.Present = false;
+			m_Buffered--;
+			m_NextSequence++;
+			m_StalledTicks = 0;
+		}
+
+		return skipped;
+	}
+
+	uint32_t GetBufferedCount() const { return m_Buffered; }
+};
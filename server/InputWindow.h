@@ -0,0 +1,62 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+
+#include "InputBuffer.h"
+
+// Remembers which of the most recent inputs from a client have been received. Clients resend every input we have
+// not acknowledged along with each new one, so most inputs turn up many times over, and this lets the network
+// thread pass each one on to the simulation thread only once.
+//
+// Only the last InputBuffer::Capacity inputs are tracked, as anything older than that would be rejected by the
+// input buffer anyway. Inputs are marked as soon as they are passed on, before the simulation thread has seen
+// them. This only holds because the input buffer takes every input which is not a duplicate or too old, moving
+// along to fit newer ones rather than turning them away, so nothing marked here is ever needed again.
+class InputWindow
+{
+public:
+	static constexpr uint32_t Capacity = InputBuffer::Capacity;
+private:
+	// Bit n is set if the input `n` before the newest has been received.
+	std::bitset<Capacity> m_Received;
+	uint32_t m_Newest = 0;
+	bool m_Started = false;
+public:
+	// Returns true if the input has been received already, or is too old to matter.
+	bool HasReceived(uint32_t sequence) const
+	{
+		if (!m_Started) { return false; }
+
+		int32_t offset = static_cast<int32_t>(m_Newest - sequence);
+		if (offset < 0) { return false; }
+		return offset >= static_cast<int32_t>(Capacity) || m_Received.test(offset);
+	}
+
+	void Mark(uint32_t sequence)
+	{
+		if (!m_Started)
+		{
+			m_Started = true;
+			m_Newest = sequence;
+		}
+
+		int32_t offset = static_cast<int32_t>(m_Newest - sequence);
+		if (offset < 0)
+		{
+			// A newer input, slide the window along.
+			uint32_t shift = static_cast<uint32_t>(-offset);
+			m_Received = shift < Capacity ? m_Received << shift : std::bitset<Capacity>();
+			m_Newest = sequence;
+			offset = 0;
+		}
+
+		if (offset < static_cast<int32_t>(Capacity)) { m_Received.set(offset); }
+	}
+
+	void Reset()
+	{
+		m_Received.reset();
+		m_Started = false;
+	}
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cassert>
+
+// A fixed capacity container which hands out generational handles to the items it stores.
+//
+// Items are kept packed together in a single contiguous array which is allocated up front, so iterating
+// over every item is a linear walk over memory and adding or removing one never allocates. A handle is a
+// 32-bit value made up of the index of a slot and the generation of that slot when the handle was created.
+// The generation is bumped every time a slot is freed, so a handle to an item which has since been removed
+// is detected and rejected rather than silently referring to whatever has taken its place.
+template<typename T>
+class Registry
+{
+public:
+	static constexpr uint32_t IndexBits = 16;
+	static constexpr uint32_t IndexMask = (1u << IndexBits) - 1;
+	static constexpr uint32_t MaxCapacity = 1u << IndexBits;
+
+	// Generations start at one, so a valid handle is never zero.
+	static constexpr uint32_t InvalidHandle = 0;
+private:
+	static constexpr uint32_t EndOfFreeList = ~0u;
+
+	struct Slot
+	{
+		uint16_t Generation = 1;
+
+		// The index of the item in the packed array while the slot is in use, or the index of the next
+		// free slot while it is not.
+		uint32_t Index = 0;
+	};
+
+	std::vector<T> m_Items;
+	std::vector<uint32_t> m_ItemSlots;
+	std::vector<Slot> m_Slots;
+	uint32_t m_FreeHead;
+public:
+	explicit Registry(uint32_t capacity)
+		: m_FreeHead(0)
+	{
+		assert(capacity > 0 && capacity <= MaxCapacity);
+
+		m_Items.reserve(capacity);
+		m_ItemSlots.reserve(capacity);
+		m_Slots.resize(capacity);
+
+		// Chain every slot into the free list.
+		for (uint32_t i = 0; i < capacity; i++)
+		{
+			m_Slots[i].Index = i + 1 < capacity ? i + 1 : EndOfFreeList;
+		}
+	}
+
+	// Adds a new item and returns its handle, or InvalidHandle if the registry is full.
+	uint32_t Allocate()
+	{
+		if (m_FreeHead == EndOfFreeList) { return InvalidHandle; }
+
+		uint32_t slotIndex = m_FreeHead;
+		Slot& slot = m_Slots[slotIndex];
+		m_FreeHead = slot.Index;
+
+		slot.Index = static_cast<uint32_t>(m_Items.size());
+		m_Items.emplace_back();
+		m_ItemSlots.push_back(slotIndex);
+
+		return MakeHandle(slotIndex, slot.Generation);
+	}
+
+	// Removes the item referred to by the handle. Stale handles are ignored.
+	void Free(uint32_t handle)
+	{
+		if (!IsValid(handle)) { return; }
+
+		uint32_t slotIndex = GetSlotIndex(handle);
+		Slot& slot = m_Slots[slotIndex];
+
+		// Keep the items packed by moving the last one into the hole.
+		uint32_t last = static_cast<uint32_t>(m_Items.size() - 1);
+		if (slot.Index != last)
+		{
+			m_Items[slot.Index] = std::move(m_Items[last]);
+			m_ItemSlots[slot.Index] = m_ItemSlots[last];
+			m_Slots[m_ItemSlots[slot.Index]].Index = slot.Index;
+		}
+		m_Items.pop_back();
+		m_ItemSlots.pop_back();
+
+		// Bump the generation to invalidate any outstanding handles, skipping zero so that a handle
+		// is never equal to InvalidHandle.
+		if (++slot.Generation == 0) { slot.Generation = 1; }
+
+		slot.Index = m_FreeHead;
+		m_FreeHead = slotIndex;
+	}
+
+	// Returns true if the handle refers to an item which is still in the registry.
+	bool IsValid(uint32_t handle) const
+	{
+		uint32_t slotIndex = GetSlotIndex(handle);
+		return handle != InvalidHandle && slotIndex < m_Slots.size() && m_Slots[slotIndex].Generation == GetGeneration(handle);
+	}
+
+	// Returns the item referred to by the handle, or nullptr if the handle is stale.
+	// The pointer is only valid until the next call to Free.
+	T* Get(uint32_t handle)
+	{
+		return IsValid(handle) ? &m_Items[m_Slots[GetSlotIndex(handle)].Index] : nullptr;
+	}
+
+	// Returns the position of the item in the packed array. The handle must be valid.
+	uint32_t GetIndex(uint32_t handle) const
+	{
+		assert(IsValid(handle));
+		return m_Slots[GetSlotIndex(handle)].Index;
+	}
+
+	// Access to the packed items, for iterating over everything in the registry.
+	// The position of an item in this array changes when other items are freed, use handles to hold on to one.
+	T& operator[](size_t i) { return m_Items[i]; }
+	const T& operator[](size_t i) const { return m_Items[i]; }
+	uint32_t GetHandle(size_t i) const { return MakeHandle(m_ItemSlots[i], m_Slots[m_ItemSlots[i]].Generation); }
+
+	size_t Size() const { return m_Items.size(); }
+	size_t Capacity() const { return m_Slots.size(); }
+
+	// The slot index is stable for as long as the item exists, and is always less than the capacity.
+	static uint32_t GetSlotIndex(uint32_t handle) { return handle & IndexMask; }
+	static uint16_t GetGeneration(uint32_t handle) { return static_cast<uint16_t>(handle >> IndexBits); }
+private:
+	static uint32_t MakeHandle(uint32_t slotIndex, uint16_t generation) { return (static_cast<uint32_t>(generation) << IndexBits) | slotIndex; }
+};
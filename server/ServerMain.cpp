@@ -1,103 +1,386 @@
 #include <iostream>
 #include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <thread>
 #include <cassert>
 #include <enet.h>
 
 #include "SharedConfig.h"
+#include "SpscQueue.h"
 #include "Packet.h"
+#include "Delivery.h"
+#include "PacketPool.h"
+#include "Compression.h"
 #include "Entity.h"
+#include "Registry.h"
+#include "InputBuffer.h"
+#include "InputWindow.h"
+#include "Snapshot.h"
+#include "SpatialGrid.h"
 
-static constexpr auto ENetWaitTime = 1000 / Config::ServerTimestep;
+using Clock = std::chrono::steady_clock;
 
-static uint64_t s_ServerStartTime;
-static ENetHost* s_Server;
-static bool s_Running = true;
+// The length of a single server tick.
+static constexpr auto TickInterval = std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) / Config::ServerTimestep;
+static constexpr float TickLength = 1.0f / Config::ServerTimestep;
+
+// The maximum number of ticks which will be simulated back to back when the server falls behind.
+// Anything beyond this is dropped, otherwise a long stall would be followed by a burst of simulation.
+static constexpr auto MaxCatchUpTicks = 5;
+
+// How often tick statistics are reported, in ticks.
+static constexpr auto TickStatsInterval = Config::ServerTimestep * 10;
+
+// How long the network thread will block on the socket before checking for outgoing packets, in milliseconds.
+static constexpr auto NetworkPollTimeout = 1;
+
+// The maximum number of ENet events handled before the network thread goes back to sending.
+static constexpr auto MaxEventsPerPoll = 256;
+
+// How many of the world states sent to each client are kept around as baselines for delta compression.
+static constexpr auto SnapshotHistorySize = 32;
+
+// How often each client is sent a full world state regardless of what it has acknowledged, in ticks.
+static constexpr uint32_t KeyframeInterval = Config::ServerTimestep * 5;
 
 struct Client
 {
-	Entity WorldEntity;
-	uint32_t LastInput;
+	uint32_t PeerID;
+	uint32_t ConnectID;
+	InputBuffer Inputs;
+
+	// The most recent world state the client has told us it received, used as the baseline for the next one.
+	uint32_t AckedSnapshot = WorldStatePacket::NoBaseline;
+
+	// The last time the client was sent a keyframe.
+	uint32_t KeyframeSequence = 0;
+
+	// How far from its own entity the client can see, along each axis.
+	float ViewRadius = 0.0f;
+
+	// The world states which have been sent to the client recently. Each client only sees the entities near it,
+	// so each is sent a different world state.
+	SnapshotHistory<SnapshotHistorySize> SentSnapshots;
+};
+
+static constexpr uint32_t InvalidHandle = Registry<Client>::InvalidHandle;
+
+// Keeps track of how well the server is keeping up with its tick rate.
+struct TickStats
+{
+	uint64_t TickNumber = 0;
+	uint64_t Overruns = 0;
+	uint64_t SkippedTicks = 0;
+	Clock::duration WorstOverrun = Clock::duration::zero();
+
+	// How long the simulation thread spent working on each tick of the current interval.
+	std::array<Clock::duration, TickStatsInterval> WorkTimes;
+	size_t WorkTimeCount = 0;
 };
 
-static std::array<Client*, Config::MaxClients> s_Clients;
-static int s_ClientCount = 0;
+// Events passed from the network thread to the simulation thread.
+enum class NetworkEventType : uint8_t
+{
+	Connect,
+	Disconnect,
+	Input,
+	SnapshotAck
+};
 
-uint64_t GetMilliseconds()
+// Connect events identify the ENet peer, everything after that refers to the client by the handle which
+// the simulation thread attached to the peer.
+struct NetworkEvent
 {
-	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-}
+	NetworkEventType Type = NetworkEventType::Connect;
+	uint32_t PeerID = 0;
+	uint32_t ConnectID = 0;
+	uint32_t ClientHandle = InvalidHandle;
+	InputSnapshot Input;
+	uint32_t Snapshot = 0;
+};
 
-uint64_t GetTime()
+// Messages passed from the simulation thread to the network thread.
+enum class OutgoingMessageType : uint8_t
 {
-	return GetMilliseconds() - s_ServerStartTime;
-}
+	// Send a packet to a single peer.
+	Send,
 
-static void CreateServer()
+	// Store a client handle in a peer, so its packets can be tagged with it.
+	Attach
+};
+
+// The connect ID is checked before a message is applied to a peer, so a message meant for a peer which has
+// since disconnected never affects a new connection which reused its slot.
+struct OutgoingMessage
+{
+	OutgoingMessageType Type = OutgoingMessageType::Send;
+	uint32_t PeerID = 0;
+	uint32_t ConnectID = 0;
+	uint32_t ClientHandle = InvalidHandle;
+	ENetPacket* Packet = nullptr;
+	PacketChannel Channel = PacketChannel::Events;
+};
+
+// A shard is an independent slice of the server with its own ENet host, network thread and simulation
+// thread. When running more than one shard every host is bound to the same port with SO_REUSEPORT, and the
+// kernel spreads incoming connections between them. Each shard owns the clients which connected to it, and
+// shares the state of its entities with the other shards once per tick so clients still see entities on other
+// shards.
+struct Shard
+{
+	uint32_t Index = 0;
+	std::string LogPrefix;
+	ENetHost* Host = nullptr;
+
+	SpscQueue<NetworkEvent, 4096> IncomingEvents;
+	SpscQueue<OutgoingMessage, 1024> OutgoingMessages;
+	std::atomic<uint64_t> DroppedInputs = 0;
+
+	// Owned by the simulation thread, the messages which must not be lost but did not fit in the outgoing queue,
+	// in the order they were queued. They are retried every tick. Room is reserved for an attach and a welcome for
+	// every client, only a storm of reconnects within a tick can go past that.
+	std::vector<OutgoingMessage> PendingMessages;
+
+	// Owned by the network thread, the packets clients are allowed to send.
+	PacketDecoder<InputPacket, SnapshotAckPacket, PingPacket> Decoder;
+
+	// Owned by the network thread, for the packets it answers itself.
+	PacketPool ReplyPackets;
+
+	// Owned by the network thread, the inputs received from each peer, indexed by peer ID.
+	std::vector<InputWindow> ReceivedInputs;
+
+	// The following are owned by the simulation thread.
+	TickStats Stats;
+
+	// When the last tick was due, which its world state is stamped with.
+	Clock::time_point TickTime;
+	uint64_t DroppedPackets = 0;
+	uint64_t RejectedInputs = 0;
+	uint64_t SkippedInputs = 0;
+
+	// Bandwidth used by world states over the current stats interval.
+	uint64_t KeyframeBytes = 0;
+	uint64_t KeyframesSent = 0;
+	uint64_t DeltaBytes = 0;
+	uint64_t DeltasSent = 0;
+	uint64_t VisibleEntities = 0;
+
+	Registry<Client> Clients;
+	std::vector<WorldStatePacket::Entry> LocalEntries;
+
+	// The current state of the whole world, including the entities of the other shards, sorted by entity ID.
+	Snapshot World;
+
+	// The entities in World sorted into a grid, for finding which are near each client.
+	SpatialGrid Grid;
+	std::vector<uint32_t> Visible;
+
+	// Reused for every world state sent, so its buffers do not need to be allocated each time.
+	WorldStatePacket WorldState;
+
+	// Packets are encoded into buffers from here, which ENet hands back once it has sent them.
+	PacketPool Packets;
+
+	// Each client owns one entity. Clients and entities are always added and removed together, so the
+	// entity of a client is at the same index in the store as the client is in the registry.
+	EntityStore Entities;
+
+	// The entities of this shard as of its last tick, read by the other shards.
+	std::mutex PublishedMutex;
+	std::vector<WorldStatePacket::Entry> PublishedEntries;
+
+	Shard(uint32_t capacity, float viewRadius)
+		: Clients(capacity), Grid(viewRadius)
+	{
+		Entities.Reserve(capacity);
+		PendingMessages.reserve(capacity * 2);
+	}
+};
+
+static Clock::time_point s_ServerStartTime;
+static std::atomic<bool> s_Running = true;
+static std::vector<std::unique_ptr<Shard>> s_Shards;
+
+// The maximum number of clients per shard.
+static uint32_t s_MaxClients = Config::DefaultMaxClients;
+
+// How many ticks of late or bursty input each client is allowed to catch up on.
+static uint32_t s_InputBufferDepth = 2;
+
+// How far from their own entity clients can see, along each axis.
+static float s_ViewRadius = 512.0f;
+
+// How many world states each client is sent a second, at most one a tick. Sending velocities lets clients
+// interpolate smoothly at lower rates, but gains nothing when every tick is sent, so by default they are only sent
+// at lower rates.
+static uint32_t s_SnapshotRate = Config::ServerTimestep;
+static bool s_SendVelocity = false;
+
+// How the datagrams of every shard are compressed. Clients must be started with the same settings.
+static CompressionSettings s_Compression;
+
+// If set, the first shard records its outgoing traffic and trains a compression dictionary from it into this file.
+static std::string s_CaptureTrafficPath;
+
+// If set, the first shard records its outgoing traffic and saves the raw datagrams to this file, for compression_bench.
+static std::string s_CaptureSamplesPath;
+
+// Creates the ENet host for a shard. When sharing the port with other shards the socket must have SO_REUSEPORT
+// set before it is bound, so we have ENet create an unbound host and bind it ourselves.
+static ENetHost* CreateHost(bool reusePort)
 {
 	ENetAddress address = { 0 };
 	address.host = ENET_HOST_ANY;
 	address.port = Config::Port;
 
-	s_Server = enet_host_create(&address, Config::MaxClients, 1, 0, 0);
-	if (s_Server == nullptr)
+	if (!reusePort)
 	{
-		std::cout << "Failed to create ENet host." << std::endl;
-		std::exit(1);
+		return enet_host_create(&address, s_MaxClients, ChannelCount, 0, 0);
+	}
+
+#ifdef SO_REUSEPORT
+	ENetHost* host = enet_host_create(nullptr, s_MaxClients, ChannelCount, 0, 0);
+	if (host == nullptr) { return nullptr; }
+
+	int enable = 1;
+	if (
+		setsockopt(host->socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != 0 ||
+		enet_socket_bind(host->socket, &address) != 0
+	) {
+		enet_host_destroy(host);
+		return nullptr;
 	}
+
+	if (enet_socket_get_address(host->socket, &host->address) < 0)
+	{
+		host->address = address;
+	}
+
+	return host;
+#else
+	std::cout << "Sharding requires SO_REUSEPORT, which is not available on this platform." << std::endl;
+	return nullptr;
+#endif
 }
 
-// Finds a free client ID in the global client pool and returns it.
-static uint32_t AssignClient()
+static void CreateShards(uint32_t count)
 {
-	for (uint32_t i = 0; i < Config::MaxClients; i++)
+	for (uint32_t i = 0; i < count; i++)
 	{
-		if (s_Clients[i] == nullptr)
+		auto shard = std::make_unique<Shard>(s_MaxClients, s_ViewRadius);
+		shard->Index = i;
+		shard->LogPrefix = count > 1 ? "Shard " + std::to_string(i) + ": " : "";
+
+		shard->Host = CreateHost(count > 1);
+		if (shard->Host == nullptr)
 		{
-			s_Clients[i] = new Client;
-			return i;
+			std::cout << shard->LogPrefix << "Failed to create ENet host." << std::endl;
+			std::exit(1);
 		}
+
+		shard->ReceivedInputs.resize(shard->Host->peerCount);
+
+		if (i == 0 && (!s_CaptureTrafficPath.empty() || !s_CaptureSamplesPath.empty()))
+		{
+			Compression::Install<TrafficCapture>(shard->Host, s_CaptureTrafficPath, s_CaptureSamplesPath, s_Compression);
+		}
+		else
+		{
+			EnableCompression(shard->Host, s_Compression);
+		}
+
+		s_Shards.push_back(std::move(shard));
 	}
+}
+
+// Converts a time to the server timeline, which is what gets sent to clients. See WelcomePacket.
+static uint32_t GetServerTime(Clock::time_point time)
+{
+	return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(time - s_ServerStartTime).count());
+}
+
+// Entity IDs are unique across all shards, each shard has its own range.
+// Within a shard the ID is the slot index of the client handle, which is stable for the lifetime of the client.
+static uint32_t GetEntityID(const Shard& shard, uint32_t clientHandle)
+{
+	return shard.Index * s_MaxClients + Registry<Client>::GetSlotIndex(clientHandle);
+}
 
-	// In theory we should never reach this point, as ENet will not accept more connections than
-	// we specified with MaxClients.
-	assert(!"Failed to assign client ID!");
+// The client handle is stored directly in the peers user data.
+static uint32_t GetPeerHandle(ENetPeer* peer)
+{
+	return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(peer->data));
 }
 
-// Frees a client ID from the global pool.
-static void UnassignClient(uint32_t id)
+static void SetPeerHandle(ENetPeer* peer, uint32_t handle)
 {
-	if (s_Clients[id] != nullptr)
+	peer->data = reinterpret_cast<void*>(static_cast<uintptr_t>(handle));
+}
+
+// Hands as many of the pending messages over to the network thread as there is room for, oldest first.
+static void FlushPendingMessages(Shard& shard)
+{
+	size_t sent = 0;
+	while (sent < shard.PendingMessages.size() && shard.OutgoingMessages.Push(shard.PendingMessages[sent]))
 	{
-		delete s_Clients[id];
-		s_Clients[id] = nullptr;
+		sent++;
 	}
+	shard.PendingMessages.erase(shard.PendingMessages.begin(), shard.PendingMessages.begin() + sent);
 }
 
-// Sends a packet to a specific client.
-static void SendPacket(ENetPeer* peer, const std::shared_ptr<Packet>& packet)
+// Queues up a message for the network thread.
+// Unreliable packets are dropped if the queue is full. Attaching a client and reliable packets must never be lost,
+// so they wait in the pending messages instead, behind any which are already waiting. We must not wait for room
+// here, the network thread may itself be waiting for room in the incoming queue, which only we drain.
+static void QueueMessage(Shard& shard, const OutgoingMessage& message)
 {
-	// Write the packet to a buffer.
-	DataWriter writer;
-	writer.Write<uint8_t>(static_cast<uint8_t>(packet->Type));
-	packet->Write(writer);
+	bool mustDeliver = message.Type == OutgoingMessageType::Attach || (message.Packet->flags & ENET_PACKET_FLAG_RELIABLE) != 0;
+	if (mustDeliver)
+	{
+		FlushPendingMessages(shard);
+		if (!shard.PendingMessages.empty() || !shard.OutgoingMessages.Push(message))
+		{
+			shard.PendingMessages.push_back(message);
+		}
+		return;
+	}
 
-	// Hand it off to ENet.
-	// Note that ENet will copy the data to its own internal buffer.
-	enet_peer_send(peer, 0, enet_packet_create(writer.GetData(), writer.GetSize(), ENET_PACKET_FLAG_RELIABLE));
+	if (!shard.OutgoingMessages.Push(message))
+	{
+		enet_packet_destroy(message.Packet);
+		shard.DroppedPackets++;
+	}
 }
 
-// Sends a packet to all clients which are connected.
-static void BroadcastPacket(const std::shared_ptr<Packet>& packet)
+// Sends a packet to a specific client. Returns the size of the encoded packet.
+template<typename T>
+static size_t SendPacket(Shard& shard, const Client& client, const T& packet)
 {
-	// Write the packet to a buffer.
-	DataWriter writer;
-	writer.Write<uint8_t>(static_cast<uint8_t>(packet->Type));
-	packet->Write(writer);
+	auto delivery = GetDelivery(T::ID);
 
-	// Hand it off to ENet.
-	// Note that ENet will copy the data to its own internal buffer.
-	enet_host_broadcast(s_Server, 0, enet_packet_create(writer.GetData(), writer.GetSize(), ENET_PACKET_FLAG_RELIABLE));
+	OutgoingMessage message;
+	message.Type = OutgoingMessageType::Send;
+	message.PeerID = client.PeerID;
+	message.ConnectID = client.ConnectID;
+	message.Packet = shard.Packets.Encode(packet, delivery.Flags);
+	message.Channel = delivery.Channel;
+
+	if (message.Packet == nullptr)
+	{
+		std::cout << shard.LogPrefix << "Failed to encode packet, it is too large." << std::endl;
+		return 0;
+	}
+
+	size_t size = message.Packet->dataLength;
+	QueueMessage(shard, message);
+	return size;
 }
 
 // Use this to check for cheating.
@@ -119,114 +402,656 @@ static bool ValidateInput(const InputSnapshot& input)
 	}
 }
 
-static void HandlePacket(const std::shared_ptr<Packet>& p, uint32_t clientID)
+// Hands an event over to the simulation thread. Returns false if the event was dropped.
+// Connects and disconnects must never be lost, so we wait for room in the queue. Inputs are dropped instead,
+// the client will send them again until they are acknowledged.
+static bool PushNetworkEvent(Shard& shard, const NetworkEvent& event)
+{
+	if (event.Type == NetworkEventType::Input)
+	{
+		if (!shard.IncomingEvents.Push(event))
+		{
+			shard.DroppedInputs++;
+			return false;
+		}
+		return true;
+	}
+
+	while (!shard.IncomingEvents.Push(event))
+	{
+		std::this_thread::yield();
+	}
+	return true;
+}
+
+// Decodes a packet received by the network thread.
+static void HandlePacket(Shard& shard, const InputPacket& packet, ENetPeer* peer)
 {
-	auto client = s_Clients[clientID];
-	if (client == nullptr) { return; }
+	NetworkEvent event;
+	event.Type = NetworkEventType::Input;
+	event.ClientHandle = GetPeerHandle(peer);
 
-	switch (p->Type)
+	// Each packet repeats every input which has not been acknowledged yet, only pass on the ones we have not seen.
+	auto& received = shard.ReceivedInputs[peer->incomingPeerID];
+	for (uint32_t i = 0; i < packet.InputCount; i++)
 	{
-	case PacketType::Input: {
-		auto packet = std::dynamic_pointer_cast<InputPacket>(p);
-		if (ValidateInput(packet->Input))
+		const auto& input = packet.Inputs[i];
+		if (received.HasReceived(input.SequenceNumber)) { continue; }
+
+		event.Input = input;
+		if (PushNetworkEvent(shard, event))
 		{
-			client->WorldEntity.Update(packet->Input);
-			client->LastInput = packet->Input.SequenceNumber;
+			received.Mark(input.SequenceNumber);
 		}
+	}
+}
+
+static void HandlePacket(Shard& shard, const SnapshotAckPacket& packet, ENetPeer* peer)
+{
+	NetworkEvent event;
+	event.Type = NetworkEventType::SnapshotAck;
+	event.ClientHandle = GetPeerHandle(peer);
+	event.Snapshot = packet.Sequence;
+	PushNetworkEvent(shard, event);
+}
+
+// Pings are answered straight from the network thread, so the time they spend waiting for a tick does not end up
+// in the clients measurements. The pong is flushed right away for the same reason.
+static void HandlePacket(Shard& shard, const PingPacket& packet, ENetPeer* peer)
+{
+	PongPacket pong;
+	pong.ClientTime = packet.ClientTime;
+	pong.ReceiveTime = GetServerTime(Clock::now());
+
+	auto delivery = GetDelivery(PongPacket::ID);
+	pong.SendTime = GetServerTime(Clock::now());
+	ENetPacket* reply = shard.ReplyPackets.Encode(pong, delivery.Flags);
+	if (reply == nullptr) { return; }
+
+	if (enet_peer_send(peer, static_cast<uint8_t>(delivery.Channel), reply) != 0)
+	{
+		enet_packet_destroy(reply);
+		return;
+	}
+	enet_host_flush(shard.Host);
+}
+
+static void HandleEvent(Shard& shard, ENetEvent& event)
+{
+	switch (event.type)
+	{
+	case ENET_EVENT_TYPE_CONNECT: {
+		// ENet does not clear the user data of a peer when it is reused, so make sure this connection does not
+		// pick up the handle of the previous one. The simulation thread will assign the client a handle and send
+		// them a welcome packet.
+		SetPeerHandle(event.peer, InvalidHandle);
+		shard.ReceivedInputs[event.peer->incomingPeerID].Reset();
+
+		NetworkEvent connect;
+		connect.Type = NetworkEventType::Connect;
+		connect.PeerID = event.peer->incomingPeerID;
+		connect.ConnectID = event.peer->connectID;
+		PushNetworkEvent(shard, connect);
+	} break;
+	case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT: case ENET_EVENT_TYPE_DISCONNECT: {
+		// If the peer has not been attached to a client yet, the simulation thread is told about the
+		// disconnect when the attach message arrives instead.
+		uint32_t handle = GetPeerHandle(event.peer);
+		if (handle == InvalidHandle) { break; }
+
+		NetworkEvent disconnect;
+		disconnect.Type = NetworkEventType::Disconnect;
+		disconnect.ClientHandle = handle;
+		PushNetworkEvent(shard, disconnect);
+		SetPeerHandle(event.peer, InvalidHandle);
+	} break;
+	case ENET_EVENT_TYPE_RECEIVE: {
+		// Anything received before the peer has been attached to a client is dropped, clients are not
+		// supposed to send anything until they have been welcomed.
+		if (GetPeerHandle(event.peer) == InvalidHandle)
+		{
+			enet_packet_destroy(event.packet);
+			break;
+		}
+
+		// Read the packet from the buffer and handle it. Packets which are cut short, or which clients have no
+		// business sending, are dropped.
+		BitReader reader(event.packet->data, event.packet->dataLength);
+		shard.Decoder.Decode(reader, [&](const auto& packet) { HandlePacket(shard, packet, event.peer); });
+
+		enet_packet_destroy(event.packet);
 	} break;
 	}
 }
 
-static void NetworkPoll()
+// Applies everything the simulation thread has queued up, handing packets over to ENet.
+static bool ProcessOutgoingMessages(Shard& shard)
 {
-	// The timeout value given to enet_host_service is the amount of time to wait until an event is received.
-	// This means that enet_host_service will have to go the entire timeout without receiving a single event in order to return.
-	// In a multiplayer scenario this is somewhat unlikely and will result in this call hanging forever, and the world will not
-	// be ticked at all.
-	// To fix this, we implement our own timer which will keep track of the time to poll for network events, and pass a timeout
-	// of zero to enet_host_service.
-	uint64_t start = GetTime();
-	while (GetTime() - start < ENetWaitTime)
+	bool sent = false;
+
+	OutgoingMessage message;
+	while (shard.OutgoingMessages.Pop(message))
 	{
+		ENetPeer* peer = &shard.Host->peers[message.PeerID];
+		bool connected = peer->state == ENET_PEER_STATE_CONNECTED && peer->connectID == message.ConnectID;
+
+		switch (message.Type)
+		{
+		case OutgoingMessageType::Send: {
+			if (connected && enet_peer_send(peer, static_cast<uint8_t>(message.Channel), message.Packet) == 0)
+			{
+				sent = true;
+			}
+			else
+			{
+				enet_packet_destroy(message.Packet);
+			}
+		} break;
+		case OutgoingMessageType::Attach: {
+			if (connected)
+			{
+				SetPeerHandle(peer, message.ClientHandle);
+			}
+			else
+			{
+				// The peer went away before it could be attached, let the simulation thread know.
+				NetworkEvent disconnect;
+				disconnect.Type = NetworkEventType::Disconnect;
+				disconnect.ClientHandle = message.ClientHandle;
+				PushNetworkEvent(shard, disconnect);
+			}
+		} break;
+		}
+	}
+
+	return sent;
+}
+
+// The network thread owns the ENet host. It receives and decodes packets, and sends whatever the
+// simulation thread produces, so acks and receive processing are never held up by a slow tick.
+static void RunNetworkThread(Shard& shard)
+{
+	while (s_Running)
+	{
+		// Block on the socket until something arrives or the poll timeout expires, then handle everything
+		// else which is already waiting without blocking again.
 		ENetEvent event;
-		if (enet_host_service(s_Server, &event, 0) > 0)
+		int result = enet_host_service(shard.Host, &event, NetworkPollTimeout);
+		for (int i = 0; result > 0 && i < MaxEventsPerPoll; i++)
 		{
-			switch (event.type)
+			HandleEvent(shard, event);
+			result = enet_host_service(shard.Host, &event, 0);
+		}
+
+		if (result < 0)
+		{
+			std::cout << shard.LogPrefix << "Error while servicing ENet host." << std::endl;
+		}
+
+		if (ProcessOutgoingMessages(shard))
+		{
+			enet_host_flush(shard.Host);
+		}
+	}
+}
+
+// Applies all events received by the network thread since the last tick.
+static void ProcessNetworkEvents(Shard& shard)
+{
+	NetworkEvent event;
+	while (shard.IncomingEvents.Pop(event))
+	{
+		switch (event.Type)
+		{
+		case NetworkEventType::Connect: {
+			// When a new client connects we will assign them a handle, attach it to their peer and send
+			// them a welcome packet containing their ID.
+			// In theory the registry can never be full, as ENet will not accept more connections than it
+			// has room for.
+			uint32_t handle = shard.Clients.Allocate();
+			assert(handle != InvalidHandle && "Failed to assign client handle!");
+
+			auto client = shard.Clients.Get(handle);
+			[[maybe_unused]] uint32_t entity = shard.Entities.Add();
+			assert(entity == shard.Clients.GetIndex(handle));
+
+			client->PeerID = event.PeerID;
+			client->ConnectID = event.ConnectID;
+			client->ViewRadius = s_ViewRadius;
+			std::cout << shard.LogPrefix << "Client connected, " << shard.Clients.Size() << "/" << shard.Clients.Capacity() << "." << std::endl;
+
+			OutgoingMessage attach;
+			attach.Type = OutgoingMessageType::Attach;
+			attach.PeerID = event.PeerID;
+			attach.ConnectID = event.ConnectID;
+			attach.ClientHandle = handle;
+			QueueMessage(shard, attach);
+
+			// Create a new packet to send to the client.
+			WelcomePacket packet;
+			packet.ClientID = GetEntityID(shard, handle);
+			packet.Tick = static_cast<uint32_t>(shard.Stats.TickNumber);
+			packet.ServerTime = GetServerTime(Clock::now());
+			packet.SnapshotRate = s_SnapshotRate;
+			SendPacket(shard, *client, packet);
+		} break;
+		case NetworkEventType::Disconnect: {
+			// When a client disconnects or times out, we can free their handle.
+			if (!shard.Clients.IsValid(event.ClientHandle)) { break; }
+			shard.Entities.Remove(shard.Clients.GetIndex(event.ClientHandle));
+			shard.Clients.Free(event.ClientHandle);
+			std::cout << shard.LogPrefix << "Client disconnected, " << shard.Clients.Size() << "/" << shard.Clients.Capacity() << "." << std::endl;
+		} break;
+		case NetworkEventType::Input: {
+			// Inputs which were queued up before the client disconnected carry a stale handle.
+			auto client = shard.Clients.Get(event.ClientHandle);
+			if (client == nullptr) { break; }
+
+			// The input is held in the clients input buffer until a tick is ready to apply it.
+			if (!ValidateInput(event.Input) || client->Inputs.Add(event.Input) != InputBuffer::AddResult::Added)
+			{
+				shard.RejectedInputs++;
+			}
+		} break;
+		case NetworkEventType::SnapshotAck: {
+			auto client = shard.Clients.Get(event.ClientHandle);
+			if (client == nullptr) { break; }
+
+			// Acks can arrive out of order, we only care about the newest.
+			if (client->AckedSnapshot == WorldStatePacket::NoBaseline || IsSequenceNewer(event.Snapshot, client->AckedSnapshot))
 			{
-			case ENET_EVENT_TYPE_CONNECT: {
-				// When a new client connects we will assign them an ID and send them a welcome packet
-				// containing their ID.
-				uint32_t id = AssignClient();
-				event.peer->data = reinterpret_cast<void*>(id);
-				s_ClientCount++;
-				std::cout << "Client connected, " << s_ClientCount << "/" << Config::MaxClients << "." << std::endl;
-
-				// Create a new packet to send to the client.
-				auto packet = Packet::Create<WelcomePacket>();
-				packet->ClientID = id;
-				SendPacket(event.peer, packet);
-			} break;
-			case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT: case ENET_EVENT_TYPE_DISCONNECT: {
-				// When a client disconnects or times out, we can free their ID from the global pool.
-				uint32_t id = reinterpret_cast<uint32_t>(event.peer->data);
-				UnassignClient(id);
-				s_ClientCount--;
-				std::cout << "Client disconnected, " << s_ClientCount << "/" << Config::MaxClients << "." << std::endl;
-			} break;
-			case ENET_EVENT_TYPE_RECEIVE: {
-				uint32_t id = reinterpret_cast<uint32_t>(event.peer->data);
-
-				DataReader reader(event.packet->data, event.packet->dataLength);
-
-				// Read the packet ID from the buffer.
-				uint8_t packetID = reader.Read<uint8_t>();
-
-				// Create the packet based on its ID.
-				auto packet = Packet::CreateFromID(packetID);
-
-				// Read the rest of the packet from the buffer.
-				packet->Read(reader);
-
-				// Handle the packet.
-				HandlePacket(packet, id);
-
-				enet_packet_destroy(event.packet);
-			} break;
+				client->AckedSnapshot = event.Snapshot;
 			}
+		} break;
 		}
 	}
 }
 
-static void RunServer()
+// Returns the given percentile of the work times which have been recorded.
+static Clock::duration GetWorkTimePercentile(TickStats& stats, float percentile)
+{
+	auto begin = stats.WorkTimes.begin();
+	auto end = begin + stats.WorkTimeCount;
+	auto nth = begin + static_cast<size_t>(percentile * (stats.WorkTimeCount - 1));
+	std::nth_element(begin, nth, end);
+	return *nth;
+}
+
+// Prints the tick statistics for the last interval.
+static void ReportTickStats(Shard& shard)
+{
+	auto& stats = shard.Stats;
+	auto toMilliseconds = [](Clock::duration d) { return std::chrono::duration<float, std::milli>(d).count(); };
+
+	if (stats.WorkTimeCount > 0)
+	{
+		auto p50 = GetWorkTimePercentile(stats, 0.50f);
+		auto p90 = GetWorkTimePercentile(stats, 0.90f);
+		auto p99 = GetWorkTimePercentile(stats, 0.99f);
+		auto max = GetWorkTimePercentile(stats, 1.00f);
+		std::cout << shard.LogPrefix << "Tick " << stats.TickNumber << ": work p50 " << toMilliseconds(p50) << "ms, p90 " << toMilliseconds(p90)
+			<< "ms, p99 " << toMilliseconds(p99) << "ms, max " << toMilliseconds(max) << "ms." << std::endl;
+	}
+
+	if (stats.Overruns > 0 || stats.SkippedTicks > 0)
+	{
+		std::cout << shard.LogPrefix << "Tick " << stats.TickNumber << ": " << stats.Overruns << " overruns (worst " << toMilliseconds(stats.WorstOverrun) << "ms), "
+			<< stats.SkippedTicks << " skipped ticks." << std::endl;
+	}
+
+	if (shard.RejectedInputs > 0 || shard.SkippedInputs > 0)
+	{
+		std::cout << shard.LogPrefix << "Tick " << stats.TickNumber << ": rejected " << shard.RejectedInputs << " invalid, duplicate or out of window inputs, skipped "
+			<< shard.SkippedInputs << " missing inputs." << std::endl;
+	}
+
+	if (uint64_t droppedInputs = shard.DroppedInputs.exchange(0); droppedInputs > 0 || shard.DroppedPackets > 0)
+	{
+		std::cout << shard.LogPrefix << "Tick " << stats.TickNumber << ": dropped " << droppedInputs << " inputs and "
+			<< shard.DroppedPackets << " outgoing packets, queues are full." << std::endl;
+	}
+
+	if (shard.KeyframesSent > 0 || shard.DeltasSent > 0)
+	{
+		std::cout << shard.LogPrefix << "Tick " << stats.TickNumber << ": world state " << shard.KeyframesSent << " keyframes averaging "
+			<< (shard.KeyframesSent > 0 ? shard.KeyframeBytes / shard.KeyframesSent : 0) << " bytes, " << shard.DeltasSent << " deltas averaging "
+			<< (shard.DeltasSent > 0 ? shard.DeltaBytes / shard.DeltasSent : 0) << " bytes, " << shard.VisibleEntities / (shard.KeyframesSent + shard.DeltasSent)
+			<< " entities visible on average." << std::endl;
+	}
+
+	stats.Overruns = 0;
+	stats.SkippedTicks = 0;
+	stats.WorstOverrun = Clock::duration::zero();
+	stats.WorkTimeCount = 0;
+	shard.DroppedPackets = 0;
+	shard.RejectedInputs = 0;
+	shard.SkippedInputs = 0;
+	shard.KeyframeBytes = 0;
+	shard.KeyframesSent = 0;
+	shard.DeltaBytes = 0;
+	shard.DeltasSent = 0;
+	shard.VisibleEntities = 0;
+}
+
+// Advances the simulation by a single tick.
+static void Simulate(Shard& shard)
+{
+	// Release a ticks worth of input from every client, then move everyone at once.
+	for (uint32_t i = 0; i < shard.Clients.Size(); i++)
+	{
+		shard.SkippedInputs += shard.Clients[i].Inputs.Consume(TickLength, s_InputBufferDepth, [&](const InputSnapshot& input)
+		{
+			shard.Entities.QueueInput(i, input);
+		});
+	}
+
+	shard.Entities.Update(TickLength);
+	shard.Stats.TickNumber++;
+}
+
+// Makes the current state of the shards entities visible to the other shards.
+static void PublishEntities(Shard& shard)
 {
-	CreateServer();
+	shard.LocalEntries.clear();
+	const auto& entities = shard.Entities;
+	for (size_t i = 0; i < shard.Clients.Size(); i++)
+	{
+		WorldStatePacket::Entry entry;
+		entry.EntityID = GetEntityID(shard, shard.Clients.GetHandle(i));
+		entry.PreviousInput = entities.LastInput[i];
+		entry.X = entities.X[i];
+		entry.Y = entities.Y[i];
+		if (s_SendVelocity)
+		{
+			entry.VelocityX = entities.VelocityX[i];
+			entry.VelocityY = entities.VelocityY[i];
+		}
+		shard.LocalEntries.push_back(entry);
+	}
+
+	if (s_Shards.size() > 1)
+	{
+		std::lock_guard<std::mutex> lock(shard.PublishedMutex);
+		shard.PublishedEntries = shard.LocalEntries;
+	}
+}
+
+// Gathers up the current state of the world. This is made up of the shards own entities plus whatever the
+// other shards published on their last tick.
+static void GatherWorldState(Shard& shard)
+{
+	auto& world = shard.World;
+	world.Sequence = static_cast<uint32_t>(shard.Stats.TickNumber);
+	world.Entries = shard.LocalEntries;
+
+	for (auto& other : s_Shards)
+	{
+		if (other.get() == &shard) { continue; }
+
+		std::lock_guard<std::mutex> lock(other->PublishedMutex);
+		world.Entries.insert(world.Entries.end(), other->PublishedEntries.begin(), other->PublishedEntries.end());
+	}
+
+	std::sort(world.Entries.begin(), world.Entries.end(), [](const auto& a, const auto& b) { return a.EntityID < b.EntityID; });
+
+	shard.Grid.Build(world.Entries.size(), [&](size_t i, float& x, float& y)
+	{
+		x = world.Entries[i].X;
+		y = world.Entries[i].Y;
+	});
+}
+
+// Fills in the world state a client can see, which is every entity within its view radius.
+static void GetVisibleWorldState(Shard& shard, size_t clientIndex, Snapshot& snapshot)
+{
+	const auto& world = shard.World.Entries;
+	float x = shard.Entities.X[clientIndex];
+	float y = shard.Entities.Y[clientIndex];
+	float radius = shard.Clients[clientIndex].ViewRadius;
+
+	shard.Visible.clear();
+	shard.Grid.Query(x - radius, y - radius, x + radius, y + radius, [&](uint32_t i)
+	{
+		if (std::abs(world[i].X - x) <= radius && std::abs(world[i].Y - y) <= radius)
+		{
+			shard.Visible.push_back(i);
+		}
+	});
+
+	// The world is sorted by entity ID, so sorting the indices keeps the world state sorted too.
+	std::sort(shard.Visible.begin(), shard.Visible.end());
+
+	snapshot.Entries.clear();
+	for (uint32_t i : shard.Visible)
+	{
+		snapshot.Entries.push_back(world[i]);
+	}
+}
+
+// Returns true if a world state should be sent after the given tick. The ticks are spread as evenly as the
+// snapshot rate allows, so at 20 a second they alternate between one and two ticks apart.
+static bool IsSnapshotTick(uint64_t tick)
+{
+	return tick == 0 || (tick * s_SnapshotRate) / Config::ServerTimestep != ((tick - 1) * s_SnapshotRate) / Config::ServerTimestep;
+}
+
+// Sends the current world state out to each of the shards clients, delta compressed against the last world
+// state they acknowledged. Each client is only sent the entities near it. Entities which come into view are
+// sent in full, and those which go out of view are sent as removed.
+static void SendWorldState(Shard& shard)
+{
+	GatherWorldState(shard);
+	uint32_t sequence = shard.World.Sequence;
+
+	for (size_t i = 0; i < shard.Clients.Size(); i++)
+	{
+		auto& client = shard.Clients[i];
+
+		auto& current = client.SentSnapshots.Push(sequence);
+		GetVisibleWorldState(shard, i, current);
+		shard.VisibleEntities += current.Entries.size();
+
+		// Clients which have not acknowledged anything yet, or whose baseline has fallen out of the history, get
+		// a keyframe. So does everyone else every so often, in case something has gone wrong.
+		const Snapshot* baseline = nullptr;
+		if (client.AckedSnapshot != WorldStatePacket::NoBaseline && sequence - client.KeyframeSequence < KeyframeInterval)
+		{
+			baseline = client.SentSnapshots.Find(client.AckedSnapshot);
+		}
 
-	std::cout << "Server listening on port " << Config::Port << "." << std::endl;
+		EncodeDelta(baseline, current, shard.WorldState);
+		shard.WorldState.ServerTime = GetServerTime(shard.TickTime);
+		shard.WorldState.HasVelocity = s_SendVelocity;
+		size_t size = SendPacket(shard, client, shard.WorldState);
+		if (baseline == nullptr)
+		{
+			client.KeyframeSequence = sequence;
+			shard.KeyframeBytes += size;
+			shard.KeyframesSent++;
+		}
+		else
+		{
+			shard.DeltaBytes += size;
+			shard.DeltasSent++;
+		}
+	}
+}
+
+// The simulation thread runs the game at a fixed tick rate, it never touches the ENet host directly.
+static void RunSimulationThread(Shard& shard)
+{
+	auto& stats = shard.Stats;
+
+	auto nextTick = Clock::now() + TickInterval;
 	while (s_Running)
 	{
-		// Poll for incoming packets.
-		NetworkPoll();
+		std::this_thread::sleep_until(nextTick);
+		auto tickStart = Clock::now();
+
+		// Retry whatever did not fit in the outgoing queue last tick, then pick up everything the network thread has
+		// received.
+		FlushPendingMessages(shard);
+		ProcessNetworkEvents(shard);
+
+		// Run every tick which is due. If the previous iteration overran we will be more than one tick behind,
+		// in which case we simulate the missed ticks back to back to catch up.
+		auto now = Clock::now();
+		uint32_t ticks = 0;
+		while (nextTick <= now && ticks < MaxCatchUpTicks)
+		{
+			shard.TickTime = nextTick;
+			Simulate(shard);
+			nextTick += TickInterval;
+			ticks++;
+		}
+
+		if (ticks > 1)
+		{
+			auto overrun = now - (nextTick - TickInterval * ticks);
+			stats.Overruns++;
+			stats.WorstOverrun = std::max(stats.WorstOverrun, overrun);
+		}
+
+		// If we are still behind then give up on the missed ticks rather than trying to simulate them all.
+		if (nextTick <= now)
+		{
+			auto skipped = (now - nextTick) / TickInterval + 1;
+			stats.SkippedTicks += skipped;
+			nextTick += TickInterval * skipped;
+
+			std::cout << shard.LogPrefix << "Server can't keep up, skipped " << skipped << " ticks." << std::endl;
+		}
 
-		// Send new world state out to clients.
-		auto packet = Packet::Create<WorldStatePacket>();
-		for (uint32_t i = 0; i < Config::MaxClients; i++)
+		// Send new world state out to clients, on the ticks which keep up the snapshot rate.
+		PublishEntities(shard);
+		if (IsSnapshotTick(stats.TickNumber))
 		{
-			auto client = s_Clients[i];
-			if (client == nullptr) { continue; }
-			WorldStatePacket::Entry entry;
-			entry.EntityID = i;
-			entry.PreviousInput = client->LastInput;
-			entry.X = client->WorldEntity.X;
-			entry.Y = client->WorldEntity.Y;
-			packet->Entries.push_back(entry);
+			SendWorldState(shard);
+		}
+
+		stats.WorkTimes[stats.WorkTimeCount++] = Clock::now() - tickStart;
+		if (stats.WorkTimeCount == stats.WorkTimes.size())
+		{
+			ReportTickStats(shard);
 		}
-		BroadcastPacket(packet);
+	}
+}
+
+static void RunServer(uint32_t shardCount)
+{
+	CreateShards(shardCount);
+
+	std::cout << "Server listening on port " << Config::Port << " with " << shardCount << (shardCount == 1 ? " shard." : " shards.") << std::endl;
+
+	std::vector<std::thread> threads;
+	for (auto& shard : s_Shards)
+	{
+		threads.emplace_back(RunNetworkThread, std::ref(*shard));
+		threads.emplace_back(RunSimulationThread, std::ref(*shard));
+	}
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	for (auto& shard : s_Shards)
+	{
+		enet_host_destroy(shard->Host);
 	}
 }
 
 int main(int argc, char** argv)
 {
-	s_ServerStartTime = GetMilliseconds();
+	s_ServerStartTime = Clock::now();
+
+	// Usage: server [--shards <count>] [--max-clients <count>] [--input-buffer <ticks>] [--view-radius <units>]
+	//               [--snapshot-rate <hz>] [--velocity <on|off|auto>]
+	//               [--compression <none|lz|range>] [--compression-dictionary <file>] [--capture-traffic <file>]
+	//               [--capture-samples <file>]
+	// A shard count of zero runs one shard per core. The client limit applies to each shard.
+	// Capturing traffic records the first shard's outgoing datagrams, compressed as usual, and trains the dictionary
+	// from them in the background. Capturing samples saves the recorded datagrams themselves.
+	uint32_t shardCount = 1;
+	std::string velocity = "auto";
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) == "--shards" && i + 1 < argc)
+		{
+			shardCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+			if (shardCount == 0) { shardCount = std::max(1u, std::thread::hardware_concurrency()); }
+		}
+		else if (std::string(argv[i]) == "--max-clients" && i + 1 < argc)
+		{
+			s_MaxClients = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (std::string(argv[i]) == "--input-buffer" && i + 1 < argc)
+		{
+			s_InputBufferDepth = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (std::string(argv[i]) == "--view-radius" && i + 1 < argc)
+		{
+			s_ViewRadius = std::stof(argv[++i]);
+		}
+		else if (std::string(argv[i]) == "--snapshot-rate" && i + 1 < argc)
+		{
+			s_SnapshotRate = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (std::string(argv[i]) == "--velocity" && i + 1 < argc)
+		{
+			velocity = argv[++i];
+			if (velocity != "on" && velocity != "off" && velocity != "auto")
+			{
+				std::cout << "Velocity must be on, off or auto." << std::endl;
+				std::exit(1);
+			}
+		}
+		else if (std::string(argv[i]) == "--compression" && i + 1 < argc)
+		{
+			if (!Compression::ParseType(argv[++i], s_Compression.Type))
+			{
+				std::cout << "Unknown compression type " << argv[i] << "." << std::endl;
+				std::exit(1);
+			}
+		}
+		else if (std::string(argv[i]) == "--compression-dictionary" && i + 1 < argc)
+		{
+			if (!Compression::LoadDictionary(argv[++i], s_Compression.Dictionary))
+			{
+				std::cout << "Failed to load compression dictionary " << argv[i] << "." << std::endl;
+				std::exit(1);
+			}
+		}
+		else if (std::string(argv[i]) == "--capture-traffic" && i + 1 < argc)
+		{
+			s_CaptureTrafficPath = argv[++i];
+		}
+		else if (std::string(argv[i]) == "--capture-samples" && i + 1 < argc)
+		{
+			s_CaptureSamplesPath = argv[++i];
+		}
+	}
+
+	// ENet can not address more peers than this per host.
+	if (s_MaxClients == 0 || s_MaxClients > ENET_PROTOCOL_MAXIMUM_PEER_ID)
+	{
+		std::cout << "The client limit must be between 1 and " << ENET_PROTOCOL_MAXIMUM_PEER_ID << "." << std::endl;
+		std::exit(1);
+	}
+
+	if (!(s_ViewRadius > 0.0f))
+	{
+		std::cout << "The view radius must be greater than zero." << std::endl;
+		std::exit(1);
+	}
+
+	if (s_SnapshotRate == 0 || s_SnapshotRate > Config::ServerTimestep)
+	{
+		std::cout << "The snapshot rate must be between 1 and " << Config::ServerTimestep << "." << std::endl;
+		std::exit(1);
+	}
+
+	s_SendVelocity = velocity == "on" || (velocity == "auto" && s_SnapshotRate < Config::ServerTimestep);
 
 	if (enet_initialize() != 0)
 	{
@@ -234,7 +1059,7 @@ int main(int argc, char** argv)
 		std::exit(1);
 	}
 
-	RunServer();
+	RunServer(shardCount);
 
 	enet_deinitialize();
 	return 0;
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+
+// A uniform grid over the world for finding the entities near a point, rebuilt from scratch every tick.
+//
+// The world has no bounds, so rather than allocating every cell the cells are hashed into a fixed number of
+// buckets. Building the grid is a counting sort of the entities by bucket, which leaves the entities in each
+// bucket packed together and never allocates once the grid has grown to fit the world. Cells which hash to the
+// same bucket share it, so a query returns every entity in the buckets it covers and the caller is expected to
+// check the positions of what it gets back.
+class SpatialGrid
+{
+private:
+	float m_CellSize;
+	float m_InverseCellSize;
+	uint32_t m_BucketMask = 0;
+
+	// The entities in bucket b are m_Items[m_BucketStart[b]] up to m_Items[m_BucketStart[b + 1]].
+	std::vector<uint32_t> m_BucketStart;
+	std::vector<uint32_t> m_Items;
+	std::vector<uint32_t> m_ItemBuckets;
+
+	// The buckets covered by the current query, so a bucket shared by two cells is only visited once.
+	std::vector<uint32_t> m_QueryBuckets;
+public:
+	explicit SpatialGrid(float cellSize)
+		: m_CellSize(cellSize), m_InverseCellSize(1.0f / cellSize)
+	{
+		assert(cellSize > 0.0f);
+	}
+
+	float GetCellSize() const { return m_CellSize; }
+
+	// Sorts `count` entities into the grid, getting the position of each one by calling position(i, x, y).
+	// Queries return the same indices.
+	template<typename GetPosition>
+	void Build(size_t count, GetPosition&& position)
+	{
+		// Keep at least twice as many buckets as entities, so most buckets hold a single cell.
+		size_t bucketCount = std::max<size_t>(m_BucketMask + 1, 64);
+		while (bucketCount < count * 2) { bucketCount *= 2; }
+		m_BucketMask = static_cast<uint32_t>(bucketCount - 1);
+
+		m_BucketStart.assign(bucketCount + 1, 0);
+		m_Items.resize(count);
+		m_ItemBuckets.resize(count);
+
+		// Count the entities in each bucket.
+		for (size_t i = 0; i < count; i++)
+		{
+			float x, y;
+			position(i, x, y);
+
+			uint32_t bucket = GetBucket(GetCell(x), GetCell(y));
+			m_ItemBuckets[i] = bucket;
+			m_BucketStart[bucket + 1]++;
+		}
+
+		// Turn the counts into offsets, then drop each entity into place.
+		for (size_t b = 0; b < bucketCount; b++)
+		{
+			m_BucketStart[b + 1] += m_BucketStart[b];
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			m_Items[m_BucketStart[m_ItemBuckets[i]]++] = static_cast<uint32_t>(i);
+		}
+
+		// Filling in the items moved each start along to the start of the next bucket, so shift them back.
+		for (size_t b = bucketCount; b > 0; b--)
+		{
+			m_BucketStart[b] = m_BucketStart[b - 1];
+		}
+		m_BucketStart[0] = 0;
+	}
+
+	// Calls visit(i) for every entity in the cells overlapping the given rectangle, along with any other entities
+	// which happen to share their buckets.
+	template<typename Visit>
+	void Query(float minX, float minY, float maxX, float maxY, Visit&& visit)
+	{
+		int32_t minCellX = GetCell(minX), maxCellX = GetCell(maxX);
+		int32_t minCellY = GetCell(minY), maxCellY = GetCell(maxY);
+
+		// A rectangle covering more cells than there are buckets covers every bucket.
+		uint64_t cellCount = uint64_t(int64_t(maxCellX) - minCellX + 1) * uint64_t(int64_t(maxCellY) - minCellY + 1);
+		if (cellCount > m_BucketMask)
+		{
+			for (uint32_t i = 0; i < m_Items.size(); i++) { visit(i); }
+			return;
+		}
+
+		m_QueryBuckets.clear();
+		for (int32_t cy = minCellY; cy <= maxCellY; cy++)
+		{
+			for (int32_t cx = minCellX; cx <= maxCellX; cx++)
+			{
+				m_QueryBuckets.push_back(GetBucket(cx, cy));
+			}
+		}
+
+		std::sort(m_QueryBuckets.begin(), m_QueryBuckets.end());
+		m_QueryBuckets.erase(std::unique(m_QueryBuckets.begin(), m_QueryBuckets.end()), m_QueryBuckets.end());
+
+		for (uint32_t bucket : m_QueryBuckets)
+		{
+			for (uint32_t i = m_BucketStart[bucket]; i < m_BucketStart[bucket + 1]; i++)
+			{
+				visit(m_Items[i]);
+			}
+		}
+	}
+private:
+	int32_t GetCell(float position) const
+	{
+		return static_cast<int32_t>(std::floor(position * m_InverseCellSize));
+	}
+
+	uint32_t GetBucket(int32_t cellX, int32_t cellY) const
+	{
+		uint32_t hash = static_cast<uint32_t>(cellX) * 0x8da6b343u ^ static_cast<uint32_t>(cellY) * 0xd8163841u;
+		return (hash ^ (hash >> 16)) & m_BucketMask;
+	}
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+
+#include "Quantize.h"
+
+// Used to read data written by a BitWriter from a buffer.
+// The buffer comes straight off the network, so reading past the end of it is not an error. Instead zeroes are
+// returned and the reader is marked as overflowed, which should be checked once the whole packet has been read.
+class BitReader
+{
+private:
+	const uint8_t* m_Buffer;
+	size_t m_Size;
+	size_t m_Ptr;
+
+	// Bits which have been read from the buffer but not handed out yet, lowest bits first.
+	uint64_t m_Scratch = 0;
+	uint32_t m_ScratchBits = 0;
+
+	bool m_Overflowed = false;
+public:
+	BitReader(const uint8_t* buffer, size_t size)
+		: m_Buffer(buffer), m_Size(size), m_Ptr(0)
+	{
+	}
+
+	// Reads `bits` bits, written by BitWriter::WriteBits.
+	uint32_t ReadBits(uint32_t bits)
+	{
+		assert(bits > 0 && bits <= 32);
+
+		if (m_ScratchBits < bits)
+		{
+			Refill();
+			if (m_ScratchBits < bits)
+			{
+				m_Overflowed = true;
+				return 0;
+			}
+		}
+
+		uint32_t value = static_cast<uint32_t>(m_Scratch & ((uint64_t(1) << bits) - 1));
+		m_Scratch >>= bits;
+		m_ScratchBits -= bits;
+		return value;
+	}
+
+	bool ReadBool()
+	{
+		return ReadBits(1) != 0;
+	}
+
+	float ReadFloat()
+	{
+		uint32_t bits = ReadBits(32);
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	uint32_t ReadVarint(uint32_t groupBits = 7)
+	{
+		assert(groupBits > 0 && groupBits < 32);
+
+		uint32_t value = 0;
+		for (uint32_t shift = 0; ; shift += groupBits)
+		{
+			// Anything which does not fit in 32 bits was not written by us.
+			if (shift >= 32)
+			{
+				m_Overflowed = true;
+				return 0;
+			}
+
+			value |= ReadBits(groupBits) << shift;
+			if (!ReadBool() || m_Overflowed) { break; }
+		}
+
+		return value;
+	}
+
+	int32_t ReadSignedVarint(uint32_t groupBits = 7)
+	{
+		return Quantize::ZigZagDecode(ReadVarint(groupBits));
+	}
+
+	// Marks the data as malformed, for checks which only the caller can make.
+	void MarkMalformed() { m_Overflowed = true; }
+
+	// Returns true if the reader ran past the end of the buffer, or found something malformed in it.
+	bool HasOverflowed() const { return m_Overflowed; }
+private:
+	// Tops up the scratch with as many whole bytes as fit. Away from the end of the buffer this is a single
+	// unaligned load, which is only ever made when there are at least 8 bytes left.
+	void Refill()
+	{
+		uint32_t bytes = (64 - m_ScratchBits) / 8;
+		if (m_Size - m_Ptr >= sizeof(uint64_t))
+		{
+			uint64_t word;
+			std::memcpy(&word, m_Buffer + m_Ptr, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			word = __builtin_bswap64(word);
+#endif
+			if (bytes < 8) { word &= (uint64_t(1) << (bytes * 8)) - 1; }
+			m_Scratch |= word << m_ScratchBits;
+			m_Ptr += bytes;
+			m_ScratchBits += bytes * 8;
+			return;
+		}
+
+		while (bytes > 0 && m_Ptr < m_Size)
+		{
+			m_Scratch |= uint64_t(m_Buffer[m_Ptr++]) << m_ScratchBits;
+			m_ScratchBits += 8;
+			bytes--;
+		}
+	}
+};
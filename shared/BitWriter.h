@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+
+#include "Quantize.h"
+
+// Used to write data to a buffer a bit at a time.
+// Values are packed back to back with no padding, the buffer is only padded out to a whole byte at the end.
+// The writer does not own the buffer and never grows it. Writing more than fits marks the writer as overflowed,
+// in which case the caller should try again with a bigger buffer.
+class BitWriter
+{
+private:
+	uint8_t* m_Buffer;
+	size_t m_Capacity;
+	size_t m_Size = 0;
+	bool m_Overflowed = false;
+
+	// Bits which have been written but do not make up a whole byte yet, lowest bits first.
+	uint64_t m_Scratch = 0;
+	uint32_t m_ScratchBits = 0;
+public:
+	BitWriter(uint8_t* buffer, size_t capacity)
+		: m_Buffer(buffer), m_Capacity(capacity)
+	{
+	}
+
+	// Writes the lowest `bits` bits of the value.
+	void WriteBits(uint32_t value, uint32_t bits)
+	{
+		assert(bits > 0 && bits <= 32);
+
+		uint64_t mask = (uint64_t(1) << bits) - 1;
+		m_Scratch |= (value & mask) << m_ScratchBits;
+		m_ScratchBits += bits;
+
+		while (m_ScratchBits >= 8)
+		{
+			PutByte(static_cast<uint8_t>(m_Scratch));
+			m_Scratch >>= 8;
+			m_ScratchBits -= 8;
+		}
+	}
+
+	void WriteBool(bool value)
+	{
+		WriteBits(value ? 1 : 0, 1);
+	}
+
+	void WriteFloat(float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		WriteBits(bits, 32);
+	}
+
+	// Writes an unsigned integer in groups of `groupBits` bits, each followed by a bit saying whether another
+	// group follows. Small values take up a single group, smaller groups suit values which are usually tiny.
+	void WriteVarint(uint32_t value, uint32_t groupBits = 7)
+	{
+		assert(groupBits > 0 && groupBits < 32);
+
+		uint32_t mask = (1u << groupBits) - 1;
+		while (value > mask)
+		{
+			WriteBits(value & mask, groupBits);
+			WriteBool(true);
+			value >>= groupBits;
+		}
+
+		WriteBits(value, groupBits);
+		WriteBool(false);
+	}
+
+	// Writes a signed integer as a varint, so values close to zero are small either side of it.
+	void WriteSignedVarint(int32_t value, uint32_t groupBits = 7)
+	{
+		WriteVarint(Quantize::ZigZagEncode(value), groupBits);
+	}
+
+	// Returns the written data, padded out to a whole byte. Nothing else can be written afterwards.
+	inline uint8_t* GetData() { Flush(); return m_Buffer; }
+	inline size_t GetSize() { Flush(); return m_Size; }
+
+	// Returns true if more was written than fits in the buffer, in which case the data is incomplete.
+	bool HasOverflowed() const { return m_Overflowed; }
+private:
+	void PutByte(uint8_t byte)
+	{
+		if (m_Size == m_Capacity)
+		{
+			m_Overflowed = true;
+			return;
+		}
+
+		m_Buffer[m_Size++] = byte;
+	}
+
+	void Flush()
+	{
+		if (m_ScratchBits > 0)
+		{
+			PutByte(static_cast<uint8_t>(m_Scratch));
+			m_Scratch = 0;
+			m_ScratchBits = 0;
+		}
+	}
+};
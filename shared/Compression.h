@@ -0,0 +1,696 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <enet.h>
+
+// Compressors for the datagrams ENet sends, installed on a host with EnableCompression.
+//
+// ENet compresses each datagram on its own, after it has packed the commands for a peer into it, so a compressor
+// sees ENet's command headers as well as our packets. Datagrams can be lost, so nothing is carried over from one
+// to the next. Instead both ends can share a dictionary of typical traffic up front, which LZ matches against and
+// the range coder takes its starting byte frequencies from.
+//
+// Both ends of a connection must use the same compression and the same dictionary, a host drops any datagram it
+// can not decompress.
+enum class CompressionType : uint8_t
+{
+	None,
+
+	// Byte oriented LZ77, cheap enough to run on every datagram. Good at the repeated headers and unchanged fields
+	// in world states.
+	LZ,
+
+	// Adaptive order-0 range coder. Slower, but gets something out of data with no repeats in it, as long as some
+	// byte values are more common than others.
+	Range
+};
+
+struct CompressionSettings
+{
+	CompressionType Type = CompressionType::None;
+
+	// Typical traffic, shared by both ends. May be empty.
+	std::vector<uint8_t> Dictionary;
+};
+
+namespace Compression
+{
+	// LZ match offsets are 16 bits, and have to reach back over the datagram into the dictionary.
+	static constexpr size_t MaxDictionarySize = 65535 - ENET_PROTOCOL_MAXIMUM_MTU;
+	static constexpr size_t DefaultDictionarySize = 16 * 1024;
+
+	// Dictionaries are made up of segments of this many bytes.
+	static constexpr size_t SegmentLength = 32;
+
+	// Copies the buffers ENet hands to a compressor into one contiguous block at the end of `data`.
+	inline void Gather(const ENetBuffer* buffers, size_t bufferCount, size_t size, std::vector<uint8_t>& data)
+	{
+		size_t offset = data.size();
+		data.resize(offset + size);
+		for (size_t i = 0; i < bufferCount && size > 0; i++)
+		{
+			size_t length = std::min(buffers[i].dataLength, size);
+			std::memcpy(data.data() + offset, buffers[i].data, length);
+			offset += length;
+			size -= length;
+		}
+	}
+
+	// Builds a dictionary of up to `size` bytes out of sample datagrams, by picking the segments whose contents turn
+	// up most often across all of them. The most useful segments go at the end, closest to the data.
+	inline std::vector<uint8_t> TrainDictionary(const std::vector<std::vector<uint8_t>>& samples, size_t size)
+	{
+		constexpr size_t KeyLength = 8;
+
+		auto readKey = [](const uint8_t* data) { uint64_t key; std::memcpy(&key, data, sizeof(key)); return key; };
+
+		// Count how often every run of KeyLength bytes occurs.
+		std::unordered_map<uint64_t, uint32_t> counts;
+		for (const auto& sample : samples)
+		{
+			for (size_t i = 0; i + KeyLength <= sample.size(); i++)
+			{
+				counts[readKey(&sample[i])]++;
+			}
+		}
+
+		// Score every segment by how common its contents are.
+		struct Segment
+		{
+			uint64_t Score;
+			uint32_t Sample;
+			uint32_t Offset;
+		};
+
+		std::vector<Segment> segments;
+		for (uint32_t s = 0; s < samples.size(); s++)
+		{
+			const auto& sample = samples[s];
+			for (size_t offset = 0; offset + SegmentLength <= sample.size(); offset += SegmentLength / 2)
+			{
+				uint64_t score = 0;
+				for (size_t i = offset; i + KeyLength <= offset + SegmentLength; i++)
+				{
+					score += counts[readKey(&sample[i])] - 1;
+				}
+				segments.push_back({ score, s, static_cast<uint32_t>(offset) });
+			}
+		}
+
+		std::sort(segments.begin(), segments.end(), [](const Segment& a, const Segment& b) { return a.Score > b.Score; });
+
+		// Take the best segments, skipping those which are mostly covered by what has been taken already.
+		size = std::min(size, MaxDictionarySize);
+		std::vector<const uint8_t*> picked;
+		for (const auto& segment : segments)
+		{
+			if (picked.size() * SegmentLength + SegmentLength > size || segment.Score == 0) { break; }
+
+			const uint8_t* data = &samples[segment.Sample][segment.Offset];
+			size_t covered = 0;
+			for (size_t i = 0; i + KeyLength <= SegmentLength; i++)
+			{
+				auto it = counts.find(readKey(data + i));
+				if (it->second == 0) { covered++; }
+			}
+			if (covered * 2 > SegmentLength - KeyLength + 1) { continue; }
+
+			for (size_t i = 0; i + KeyLength <= SegmentLength; i++)
+			{
+				counts[readKey(data + i)] = 0;
+			}
+			picked.push_back(data);
+		}
+
+		std::vector<uint8_t> dictionary;
+		for (auto it = picked.rbegin(); it != picked.rend(); ++it)
+		{
+			dictionary.insert(dictionary.end(), *it, *it + SegmentLength);
+		}
+		return dictionary;
+	}
+
+	inline bool LoadDictionary(const std::string& path, std::vector<uint8_t>& dictionary)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file) { return false; }
+
+		dictionary.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		if (dictionary.size() > MaxDictionarySize)
+		{
+			dictionary.erase(dictionary.begin(), dictionary.end() - MaxDictionarySize);
+		}
+		return true;
+	}
+
+	inline bool SaveDictionary(const std::string& path, const std::vector<uint8_t>& dictionary)
+	{
+		std::ofstream file(path, std::ios::binary);
+		file.write(reinterpret_cast<const char*>(dictionary.data()), dictionary.size());
+		return static_cast<bool>(file);
+	}
+
+	// Sample datagrams are stored one after the other, each as a 16 bit little endian length followed by its bytes.
+	inline bool SaveSamples(const std::string& path, const std::vector<std::vector<uint8_t>>& samples)
+	{
+		std::ofstream file(path, std::ios::binary);
+		for (const auto& sample : samples)
+		{
+			uint8_t length[2] = { static_cast<uint8_t>(sample.size()), static_cast<uint8_t>(sample.size() >> 8) };
+			file.write(reinterpret_cast<const char*>(length), sizeof(length));
+			file.write(reinterpret_cast<const char*>(sample.data()), sample.size());
+		}
+		return static_cast<bool>(file);
+	}
+
+	inline bool LoadSamples(const std::string& path, std::vector<std::vector<uint8_t>>& samples)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file) { return false; }
+
+		uint8_t length[2];
+		while (file.read(reinterpret_cast<char*>(length), sizeof(length)))
+		{
+			auto& sample = samples.emplace_back(length[0] | (length[1] << 8));
+			if (!file.read(reinterpret_cast<char*>(sample.data()), sample.size())) { return false; }
+		}
+		return file.eof();
+	}
+
+	inline bool ParseType(const std::string& name, CompressionType& type)
+	{
+		if (name == "none") { type = CompressionType::None; }
+		else if (name == "lz") { type = CompressionType::LZ; }
+		else if (name == "range") { type = CompressionType::Range; }
+		else { return false; }
+		return true;
+	}
+}
+
+// LZ77 in the style of LZ4. The output is a series of sequences, each of which is a token byte holding the number
+// of literals and the length of the match, any literals, then a 16 bit offset back to the match. Lengths which do
+// not fit in the token carry on in extra bytes. The last sequence only has literals.
+// The dictionary sits in front of the datagram, so matches can reach back into it.
+class LZCompressor
+{
+private:
+	static constexpr size_t MinMatch = 4;
+	static constexpr uint32_t HashBits = 12;
+
+	// The dictionary followed by the datagram being compressed or decompressed.
+	std::vector<uint8_t> m_Window;
+	size_t m_DictionarySize;
+
+	// The last position each hash was seen at in the dictionary, plus one so zero can mean none.
+	std::vector<uint16_t> m_DictionaryTable;
+
+	// The last position each hash was seen at in the current datagram, tagged with the generation it was written in
+	// so the table does not have to be cleared for every datagram.
+	std::array<uint32_t, 1 << HashBits> m_Table = {};
+	uint32_t m_Generation = 0;
+public:
+	explicit LZCompressor(const std::vector<uint8_t>& dictionary)
+		: m_Window(dictionary), m_DictionarySize(dictionary.size()), m_DictionaryTable(size_t(1) << HashBits, 0)
+	{
+		for (size_t i = 0; i + MinMatch <= m_DictionarySize; i++)
+		{
+			m_DictionaryTable[Hash(&m_Window[i])] = static_cast<uint16_t>(i + 1);
+		}
+	}
+
+	size_t Compress(const ENetBuffer* buffers, size_t bufferCount, size_t inLimit, uint8_t* out, size_t outLimit)
+	{
+		m_Window.resize(m_DictionarySize);
+		Compression::Gather(buffers, bufferCount, inLimit, m_Window);
+
+		if (++m_Generation > 0xFFFF)
+		{
+			m_Table.fill(0);
+			m_Generation = 1;
+		}
+
+		const uint8_t* window = m_Window.data();
+		size_t end = m_Window.size();
+		size_t anchor = m_DictionarySize;
+		size_t size = 0;
+
+		for (size_t position = m_DictionarySize; position + MinMatch <= end; )
+		{
+			uint32_t hash = Hash(window + position);
+			uint32_t entry = m_Table[hash];
+			m_Table[hash] = (m_Generation << 16) | static_cast<uint32_t>(position);
+
+			// Look for a match earlier in the datagram, then in the dictionary.
+			size_t match = SIZE_MAX;
+			if ((entry >> 16) == m_Generation && std::memcmp(window + (entry & 0xFFFF), window + position, MinMatch) == 0)
+			{
+				match = entry & 0xFFFF;
+			}
+			else if (m_DictionaryTable[hash] != 0 && std::memcmp(window + m_DictionaryTable[hash] - 1, window + position, MinMatch) == 0)
+			{
+				match = m_DictionaryTable[hash] - 1;
+			}
+
+			if (match == SIZE_MAX)
+			{
+				position++;
+				continue;
+			}
+
+			size_t length = MinMatch;
+			while (position + length < end && window[match + length] == window[position + length]) { length++; }
+
+			if (!WriteSequence(out, outLimit, size, window + anchor, position - anchor, position - match, length)) { return 0; }
+
+			position += length;
+			anchor = position;
+		}
+
+		if (!WriteSequence(out, outLimit, size, window + anchor, end - anchor, 0, 0)) { return 0; }
+		return size;
+	}
+
+	size_t Decompress(const uint8_t* in, size_t inLimit, uint8_t* out, size_t outLimit)
+	{
+		m_Window.resize(m_DictionarySize + outLimit);
+		uint8_t* window = m_Window.data();
+		size_t position = m_DictionarySize;
+		size_t end = m_DictionarySize + outLimit;
+
+		size_t read = 0;
+		while (read < inLimit)
+		{
+			uint8_t token = in[read++];
+
+			size_t literals = token >> 4;
+			if (literals == 15 && !ReadLength(in, inLimit, read, literals)) { return 0; }
+			if (literals > inLimit - read || literals > end - position) { return 0; }
+
+			std::memcpy(window + position, in + read, literals);
+			position += literals;
+			read += literals;
+
+			// The last sequence has no match.
+			if (read == inLimit) { break; }
+
+			if (inLimit - read < 2) { return 0; }
+			size_t offset = in[read] | (in[read + 1] << 8);
+			read += 2;
+
+			size_t length = (token & 15);
+			if (length == 15 && !ReadLength(in, inLimit, read, length)) { return 0; }
+			length += MinMatch;
+
+			if (offset == 0 || offset > position || length > end - position) { return 0; }
+
+			// Matches can overlap what they are writing, so copy a byte at a time.
+			for (size_t i = 0; i < length; i++, position++)
+			{
+				window[position] = window[position - offset];
+			}
+		}
+
+		size_t size = position - m_DictionarySize;
+		std::memcpy(out, window + m_DictionarySize, size);
+		return size;
+	}
+private:
+	static uint32_t Hash(const uint8_t* data)
+	{
+		uint32_t value;
+		std::memcpy(&value, data, sizeof(value));
+		return (value * 2654435761u) >> (32 - HashBits);
+	}
+
+	static bool WriteLength(uint8_t* out, size_t outLimit, size_t& size, size_t length)
+	{
+		for (; length >= 255; length -= 255)
+		{
+			if (size == outLimit) { return false; }
+			out[size++] = 255;
+		}
+
+		if (size == outLimit) { return false; }
+		out[size++] = static_cast<uint8_t>(length);
+		return true;
+	}
+
+	static bool ReadLength(const uint8_t* in, size_t inLimit, size_t& read, size_t& length)
+	{
+		uint8_t byte;
+		do
+		{
+			if (read == inLimit) { return false; }
+			byte = in[read++];
+			length += byte;
+		} while (byte == 255);
+		return true;
+	}
+
+	// Writes a sequence, or returns false if it does not fit. A length of zero writes a final sequence with no match.
+	static bool WriteSequence(uint8_t* out, size_t outLimit, size_t& size, const uint8_t* literals, size_t literalCount, size_t offset, size_t length)
+	{
+		size_t matchLength = length > 0 ? length - MinMatch : 0;
+
+		if (size == outLimit) { return false; }
+		out[size++] = static_cast<uint8_t>((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchLength, 15));
+		if (literalCount >= 15 && !WriteLength(out, outLimit, size, literalCount - 15)) { return false; }
+
+		if (literalCount > outLimit - size) { return false; }
+		std::memcpy(out + size, literals, literalCount);
+		size += literalCount;
+
+		if (length == 0) { return true; }
+
+		if (outLimit - size < 2) { return false; }
+		out[size++] = static_cast<uint8_t>(offset);
+		out[size++] = static_cast<uint8_t>(offset >> 8);
+		return matchLength < 15 || WriteLength(out, outLimit, size, matchLength - 15);
+	}
+};
+
+// An adaptive order-0 range coder. Every datagram starts from the same byte frequencies, those of the dictionary
+// if there is one, and adapts them as it goes. The frequencies are kept in a Fenwick tree, so finding the
+// cumulative frequency of a byte, or the byte at a cumulative frequency, takes eight steps.
+//
+// The coder itself is Subbotin's carryless range coder. The datagram starts with its length as a varint.
+class RangeCompressor
+{
+private:
+	static constexpr uint32_t Top = 1u << 24;
+	static constexpr uint32_t Bottom = 1u << 16;
+	static constexpr uint32_t Increment = 24;
+	static constexpr size_t SymbolCount = 256;
+
+	struct Model
+	{
+		std::array<uint32_t, SymbolCount> Frequencies;
+		std::array<uint32_t, SymbolCount + 1> Tree;
+		uint32_t Total;
+	};
+
+	Model m_Initial;
+	Model m_Model;
+public:
+	explicit RangeCompressor(const std::vector<uint8_t>& dictionary)
+	{
+		// Start from how often each byte shows up in the dictionary, scaled down so the model still adapts quickly.
+		std::array<uint64_t, SymbolCount> counts = {};
+		for (uint8_t byte : dictionary) { counts[byte]++; }
+
+		for (size_t s = 0; s < SymbolCount; s++)
+		{
+			m_Initial.Frequencies[s] = 1 + static_cast<uint32_t>(dictionary.empty() ? 0 : counts[s] * 4096 / dictionary.size());
+		}
+		Rebuild(m_Initial);
+	}
+
+	size_t Compress(const ENetBuffer* buffers, size_t bufferCount, size_t inLimit, uint8_t* out, size_t outLimit)
+	{
+		m_Model = m_Initial;
+
+		size_t size = 0;
+		for (size_t length = inLimit; ; length >>= 7)
+		{
+			if (size == outLimit) { return 0; }
+			out[size++] = static_cast<uint8_t>((length & 127) | (length >= 128 ? 128 : 0));
+			if (length < 128) { break; }
+		}
+
+		uint32_t low = 0, range = ~0u;
+		for (size_t b = 0, remaining = inLimit; b < bufferCount && remaining > 0; b++)
+		{
+			auto data = static_cast<const uint8_t*>(buffers[b].data);
+			size_t length = std::min(buffers[b].dataLength, remaining);
+			remaining -= length;
+
+			for (size_t i = 0; i < length; i++)
+			{
+				uint8_t symbol = data[i];
+				range /= m_Model.Total;
+				low += GetCumulative(m_Model, symbol) * range;
+				range *= m_Model.Frequencies[symbol];
+
+				while ((low ^ (low + range)) < Top || (range < Bottom && ((range = -low & (Bottom - 1)), true)))
+				{
+					if (size == outLimit) { return 0; }
+					out[size++] = static_cast<uint8_t>(low >> 24);
+					low <<= 8;
+					range <<= 8;
+				}
+
+				Update(m_Model, symbol);
+			}
+		}
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (size == outLimit) { return 0; }
+			out[size++] = static_cast<uint8_t>(low >> 24);
+			low <<= 8;
+		}
+
+		return size;
+	}
+
+	size_t Decompress(const uint8_t* in, size_t inLimit, uint8_t* out, size_t outLimit)
+	{
+		m_Model = m_Initial;
+
+		size_t read = 0;
+		size_t length = 0;
+		for (uint32_t shift = 0; ; shift += 7)
+		{
+			if (read == inLimit || shift > 21) { return 0; }
+			uint8_t byte = in[read++];
+			length |= size_t(byte & 127) << shift;
+			if (!(byte & 128)) { break; }
+		}
+
+		if (length == 0 || length > outLimit) { return 0; }
+
+		// Running off the end of the input means the datagram is corrupt, the encoder writes every byte we read.
+		bool overran = false;
+		auto next = [&]() -> uint32_t
+		{
+			if (read == inLimit) { overran = true; return 0; }
+			return in[read++];
+		};
+
+		uint32_t low = 0, range = ~0u, code = 0;
+		for (int i = 0; i < 4; i++) { code = (code << 8) | next(); }
+
+		for (size_t i = 0; i < length; i++)
+		{
+			range /= m_Model.Total;
+			uint32_t target = std::min((code - low) / range, m_Model.Total - 1);
+
+			uint8_t symbol = Find(m_Model, target);
+			low += GetCumulative(m_Model, symbol) * range;
+			range *= m_Model.Frequencies[symbol];
+
+			while ((low ^ (low + range)) < Top || (range < Bottom && ((range = -low & (Bottom - 1)), true)))
+			{
+				code = (code << 8) | next();
+				low <<= 8;
+				range <<= 8;
+			}
+
+			out[i] = symbol;
+			Update(m_Model, symbol);
+		}
+
+		return overran ? 0 : length;
+	}
+private:
+	static void Rebuild(Model& model)
+	{
+		model.Tree.fill(0);
+		model.Total = 0;
+		for (size_t s = 0; s < SymbolCount; s++)
+		{
+			model.Total += model.Frequencies[s];
+			for (size_t i = s + 1; i <= SymbolCount; i += i & (~i + 1))
+			{
+				model.Tree[i] += model.Frequencies[s];
+			}
+		}
+	}
+
+	// The total frequency of every symbol below this one.
+	static uint32_t GetCumulative(const Model& model, uint8_t symbol)
+	{
+		uint32_t sum = 0;
+		for (size_t i = symbol; i > 0; i -= i & (~i + 1))
+		{
+			sum += model.Tree[i];
+		}
+		return sum;
+	}
+
+	// The symbol whose range of cumulative frequencies contains the target.
+	static uint8_t Find(const Model& model, uint32_t target)
+	{
+		size_t position = 0;
+		for (size_t step = SymbolCount; step > 0; step >>= 1)
+		{
+			if (position + step <= SymbolCount && model.Tree[position + step] <= target)
+			{
+				position += step;
+				target -= model.Tree[position];
+			}
+		}
+		return static_cast<uint8_t>(position);
+	}
+
+	static void Update(Model& model, uint8_t symbol)
+	{
+		model.Frequencies[symbol] += Increment;
+		model.Total += Increment;
+		for (size_t i = symbol + 1; i <= SymbolCount; i += i & (~i + 1))
+		{
+			model.Tree[i] += Increment;
+		}
+
+		// The coder needs the total to stay below Bottom.
+		if (model.Total >= Bottom)
+		{
+			for (auto& frequency : model.Frequencies) { frequency = (frequency + 1) / 2; }
+			Rebuild(model);
+		}
+	}
+};
+
+// Records the datagrams a host sends, while compressing them as the host was configured to. Once it has enough of
+// them it trains a dictionary from them on a thread of its own and saves it to a file, to be handed to both ends with
+// --compression-dictionary. The samples themselves can be saved too, for compression_bench to try every compressor on.
+// Either path may be left empty.
+class TrafficCapture
+{
+private:
+	static constexpr size_t SampleCount = 4096;
+
+	std::string m_DictionaryPath;
+	std::string m_SamplesPath;
+	std::vector<std::vector<uint8_t>> m_Samples;
+	std::thread m_Trainer;
+
+	// The compressor the host was configured with, if any, which does the actual work.
+	std::unique_ptr<LZCompressor> m_LZ;
+	std::unique_ptr<RangeCompressor> m_Range;
+
+	static void Train(std::vector<std::vector<uint8_t>> samples, std::string dictionaryPath, std::string samplesPath)
+	{
+		if (!samplesPath.empty())
+		{
+			if (Compression::SaveSamples(samplesPath, samples))
+			{
+				std::cout << "Saved " << samples.size() << " sample datagrams to " << samplesPath << "." << std::endl;
+			}
+			else
+			{
+				std::cout << "Failed to save the sample datagrams to " << samplesPath << "." << std::endl;
+			}
+		}
+
+		if (dictionaryPath.empty()) { return; }
+
+		auto dictionary = Compression::TrainDictionary(samples, Compression::DefaultDictionarySize);
+		if (Compression::SaveDictionary(dictionaryPath, dictionary))
+		{
+			std::cout << "Saved a " << dictionary.size() << " byte compression dictionary to " << dictionaryPath << "." << std::endl;
+		}
+		else
+		{
+			std::cout << "Failed to save the compression dictionary to " << dictionaryPath << "." << std::endl;
+		}
+	}
+public:
+	TrafficCapture(const std::string& dictionaryPath, const std::string& samplesPath, const CompressionSettings& settings)
+		: m_DictionaryPath(dictionaryPath), m_SamplesPath(samplesPath)
+	{
+		m_Samples.reserve(SampleCount);
+
+		switch (settings.Type)
+		{
+		case CompressionType::None: break;
+		case CompressionType::LZ: m_LZ = std::make_unique<LZCompressor>(settings.Dictionary); break;
+		case CompressionType::Range: m_Range = std::make_unique<RangeCompressor>(settings.Dictionary); break;
+		}
+	}
+
+	// The host is only destroyed on shutdown, which waits for everything to be saved.
+	~TrafficCapture()
+	{
+		if (m_Trainer.joinable()) { m_Trainer.join(); }
+	}
+
+	size_t Compress(const ENetBuffer* buffers, size_t bufferCount, size_t inLimit, uint8_t* out, size_t outLimit)
+	{
+		// Datagrams too small to hold a segment of the dictionary are mostly acknowledgements, and are of no use. Once
+		// the trainer has been started there is nothing more to record.
+		if (!m_Trainer.joinable() && inLimit >= Compression::SegmentLength)
+		{
+			m_Samples.emplace_back();
+			Compression::Gather(buffers, bufferCount, inLimit, m_Samples.back());
+
+			// Training takes far longer than a tick, so it must not hold up the network thread.
+			if (m_Samples.size() == SampleCount)
+			{
+				m_Trainer = std::thread(Train, std::move(m_Samples), m_DictionaryPath, m_SamplesPath);
+			}
+		}
+
+		if (m_LZ) { return m_LZ->Compress(buffers, bufferCount, inLimit, out, outLimit); }
+		if (m_Range) { return m_Range->Compress(buffers, bufferCount, inLimit, out, outLimit); }
+		return 0;
+	}
+
+	size_t Decompress(const uint8_t* in, size_t inLimit, uint8_t* out, size_t outLimit)
+	{
+		if (m_LZ) { return m_LZ->Decompress(in, inLimit, out, outLimit); }
+		if (m_Range) { return m_Range->Decompress(in, inLimit, out, outLimit); }
+		return 0;
+	}
+};
+
+namespace Compression
+{
+	// Installs a compressor on a host, which owns it from then on.
+	template<typename T, typename... Args>
+	inline void Install(ENetHost* host, Args&&... args)
+	{
+		ENetCompressor compressor;
+		compressor.context = new T(std::forward<Args>(args)...);
+		compressor.compress = [](void* context, const ENetBuffer* buffers, size_t bufferCount, size_t inLimit, enet_uint8* out, size_t outLimit)
+		{
+			return static_cast<T*>(context)->Compress(buffers, bufferCount, inLimit, out, outLimit);
+		};
+		compressor.decompress = [](void* context, const enet_uint8* in, size_t inLimit, enet_uint8* out, size_t outLimit)
+		{
+			return static_cast<T*>(context)->Decompress(in, inLimit, out, outLimit);
+		};
+		compressor.destroy = [](void* context) { delete static_cast<T*>(context); };
+		enet_host_compress(host, &compressor);
+	}
+}
+
+inline void EnableCompression(ENetHost* host, const CompressionSettings& settings)
+{
+	switch (settings.Type)
+	{
+	case CompressionType::None: enet_host_compress(host, nullptr); break;
+	case CompressionType::LZ: Compression::Install<LZCompressor>(host, settings.Dictionary); break;
+	case CompressionType::Range: Compression::Install<RangeCompressor>(host, settings.Dictionary); break;
+	}
+}
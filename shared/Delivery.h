@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <enet.h>
+
+#include "Packet.h"
+
+// The ENet channels packets are sent on. Each channel is sequenced separately, so losing a packet on one channel
+// never holds up packets on the others.
+enum class PacketChannel : uint8_t
+{
+	// Reliable, ordered messages such as the welcome.
+	Events,
+
+	// Unreliable inputs from the client. Each input packet repeats the inputs before it which have not been
+	// acknowledged, so a lost one is covered by the next rather than holding everything up until it is resent.
+	Input,
+
+	// Unreliable world states and their acknowledgements. Any world state which is lost is simply replaced by the
+	// next one, so there is no point holding the rest up to resend it.
+	WorldState,
+
+	Count
+};
+
+static constexpr size_t ChannelCount = static_cast<size_t>(PacketChannel::Count);
+
+// Describes how a packet of a given type is delivered.
+struct Delivery
+{
+	PacketChannel Channel;
+	uint32_t Flags;
+};
+
+inline Delivery GetDelivery(PacketType type)
+{
+	switch (type)
+	{
+	case PacketType::Welcome: return { PacketChannel::Events, ENET_PACKET_FLAG_RELIABLE };
+	case PacketType::Input: return { PacketChannel::Input, ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT };
+
+	// World states are sequenced, so ENet drops any which arrive after a newer one. Large ones are fragmented
+	// unreliably too, rather than ENet falling back to sending the fragments reliably.
+	case PacketType::WorldState: return { PacketChannel::WorldState, ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT };
+
+	// Acks only ever move the baseline forwards, so the order they arrive in does not matter.
+	case PacketType::SnapshotAck: return { PacketChannel::WorldState, ENET_PACKET_FLAG_UNSEQUENCED };
+
+	// Each pong is matched to its ping by the time it echoes, and any which is lost is simply not used.
+	case PacketType::Ping: return { PacketChannel::WorldState, ENET_PACKET_FLAG_UNSEQUENCED };
+	case PacketType::Pong: return { PacketChannel::WorldState, ENET_PACKET_FLAG_UNSEQUENCED };
+	default: return { PacketChannel::Events, ENET_PACKET_FLAG_RELIABLE };
+	}
+}
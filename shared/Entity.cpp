@@ -1,7 +1,124 @@
 #include "Entity.h"
 
-void Entity::Update(const InputSnapshot& input)
+#if defined(__AVX__)
+	#include <immintrin.h>
+	#define ENTITY_STORE_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define ENTITY_STORE_SSE
+#endif
+
+// Moves one axis of every entity by its queued movement, records the resulting velocity and clears the
+// queued movement ready for the next tick.
+static void Integrate(float* position, float* velocity, float* move, size_t count, float speed, float inverseDt)
+{
+	size_t i = 0;
+
+#if defined(ENTITY_STORE_AVX)
+	const __m256 speed8 = _mm256_set1_ps(speed);
+	const __m256 inverseDt8 = _mm256_set1_ps(inverseDt);
+	const __m256 zero8 = _mm256_setzero_ps();
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 displacement = _mm256_mul_ps(_mm256_loadu_ps(move + i), speed8);
+		_mm256_storeu_ps(position + i, _mm256_add_ps(_mm256_loadu_ps(position + i), displacement));
+		_mm256_storeu_ps(velocity + i, _mm256_mul_ps(displacement, inverseDt8));
+		_mm256_storeu_ps(move + i, zero8);
+	}
+#elif defined(ENTITY_STORE_SSE)
+	const __m128 speed4 = _mm_set1_ps(speed);
+	const __m128 inverseDt4 = _mm_set1_ps(inverseDt);
+	const __m128 zero4 = _mm_setzero_ps();
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 displacement = _mm_mul_ps(_mm_loadu_ps(move + i), speed4);
+		_mm_storeu_ps(position + i, _mm_add_ps(_mm_loadu_ps(position + i), displacement));
+		_mm_storeu_ps(velocity + i, _mm_mul_ps(displacement, inverseDt4));
+		_mm_storeu_ps(move + i, zero4);
+	}
+#endif
+
+	// Whatever is left over, or everything if there is no vector unit to use.
+	for (; i < count; i++)
+	{
+		float displacement = move[i] * speed;
+		position[i] += displacement;
+		velocity[i] = displacement * inverseDt;
+		move[i] = 0.0f;
+	}
+}
+
+void EntityStore::Reserve(size_t capacity)
+{
+	X.reserve(capacity);
+	Y.reserve(capacity);
+	VelocityX.reserve(capacity);
+	VelocityY.reserve(capacity);
+	LastInput.reserve(capacity);
+	m_MoveX.reserve(capacity);
+	m_MoveY.reserve(capacity);
+}
+
+uint32_t EntityStore::Add(float x, float y)
+{
+	X.push_back(x);
+	Y.push_back(y);
+	VelocityX.push_back(0.0f);
+	VelocityY.push_back(0.0f);
+	LastInput.push_back(0);
+	m_MoveX.push_back(0.0f);
+	m_MoveY.push_back(0.0f);
+	return static_cast<uint32_t>(X.size() - 1);
+}
+
+void EntityStore::Remove(uint32_t index)
+{
+	size_t last = X.size() - 1;
+	if (index != last)
+	{
+		X[index] = X[last];
+		Y[index] = Y[last];
+		VelocityX[index] = VelocityX[last];
+		VelocityY[index] = VelocityY[last];
+		LastInput[index] = LastInput[last];
+		m_MoveX[index] = m_MoveX[last];
+		m_MoveY[index] = m_MoveY[last];
+	}
+
+	X.pop_back();
+	Y.pop_back();
+	VelocityX.pop_back();
+	VelocityY.pop_back();
+	LastInput.pop_back();
+	m_MoveX.pop_back();
+	m_MoveY.pop_back();
+}
+
+void EntityStore::QueueInput(uint32_t index, const InputSnapshot& input)
+{
+	m_MoveX[index] += input.DeltaX * input.DeltaTime;
+	m_MoveY[index] += input.DeltaY * input.DeltaTime;
+	LastInput[index] = input.SequenceNumber;
+}
+
+void EntityStore::ApplyInput(uint32_t index, const InputSnapshot& input)
+{
+	float dx, dy;
+	GetDisplacement(input, dx, dy);
+	X[index] += dx;
+	Y[index] += dy;
+	LastInput[index] = input.SequenceNumber;
+}
+
+void EntityStore::GetDisplacement(const InputSnapshot& input, float& dx, float& dy)
+{
+	dx = (input.DeltaX * input.DeltaTime) * Speed;
+	dy = (input.DeltaY * input.DeltaTime) * Speed;
+}
+
+void EntityStore::Update(float dt)
 {
-	this->X += input.DeltaX * Speed * input.DeltaTime;
-	this->Y += input.DeltaY * Speed * input.DeltaTime;
+	float inverseDt = dt > 0.0f ? 1.0f / dt : 0.0f;
+	Integrate(X.data(), VelocityX.data(), m_MoveX.data(), X.size(), Speed, inverseDt);
+	Integrate(Y.data(), VelocityY.data(), m_MoveY.data(), Y.size(), Speed, inverseDt);
 }
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <vector>
 #include <cstdint>
+#include <cstddef>
 
 // Represents a snapshot of an entities input at some particular point in time.
 struct InputSnapshot
@@ -25,15 +27,50 @@ struct InputSnapshot
 	}
 };
 
-// Represents an entity in the world.
-class Entity
+// Stores the state of every entity in the world as a structure of arrays, so that the whole world can be
+// stepped at once by a vectorized kernel.
+// Entities are kept packed, removing one moves the last entity into its place.
+class EntityStore
 {
 public:
 	static constexpr float Speed = 128.0f;
 public:
-	float X = 0;
-	float Y = 0;
+	std::vector<float> X;
+	std::vector<float> Y;
+
+	// The velocity of each entity over the last update, in units per second.
+	std::vector<float> VelocityX;
+	std::vector<float> VelocityY;
+
+	// The sequence number of the last input applied to each entity.
+	std::vector<uint32_t> LastInput;
+private:
+	// The movement queued up for each entity since the last update, not yet scaled by speed.
+	std::vector<float> m_MoveX;
+	std::vector<float> m_MoveY;
 public:
-	// Updates this entities position based on the supplied input and delta time.
-	void Update(const InputSnapshot& input);
+	// Makes room for the given number of entities, so adding them later does not allocate.
+	void Reserve(size_t capacity);
+
+	// Adds an entity at the given position and returns its index.
+	uint32_t Add(float x = 0, float y = 0);
+
+	// Removes an entity by moving the last entity into its place.
+	void Remove(uint32_t index);
+
+	size_t Size() const { return X.size(); }
+
+	// Queues up an input to be applied to an entity on the next update.
+	void QueueInput(uint32_t index, const InputSnapshot& input);
+
+	// Applies an input to an entity right away, used for prediction on the client.
+	// This moves the entity exactly as far as queueing the input and updating would.
+	void ApplyInput(uint32_t index, const InputSnapshot& input);
+
+	// Returns how far applying an input moves an entity.
+	static void GetDisplacement(const InputSnapshot& input, float& dx, float& dy);
+
+	// Moves every entity by the input queued up for it since the last update.
+	// The delta time is the length of the tick, and is only used to work out velocities.
+	void Update(float dt);
 };
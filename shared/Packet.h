@@ -1,20 +1,28 @@
 #pragma once
 
-#include <memory>
+#include <array>
+#include <tuple>
 
 #include "Entity.h"
 
-#include "DataReader.h"
-#include "DataWriter.h"
+#include "SharedConfig.h"
+#include "Quantize.h"
+#include "Schema.h"
+#include "BitReader.h"
+#include "BitWriter.h"
 
 enum class PacketType : uint8_t
 {
 	Welcome,
 	Input,
-	WorldState
+	WorldState,
+	SnapshotAck,
+	Ping,
+	Pong
 };
 
 // Basic serialization layer on top of ENet.
+// Each packet lists its fields in a Fields schema, which is what reads and writes it, see Schema.h.
 struct Packet
 {
 	const PacketType Type;
@@ -23,126 +31,492 @@ struct Packet
 		: Type(type)
 	{
 	}
-
-	virtual ~Packet() = default;
-
-	virtual void Read(DataReader& reader) = 0;
-	virtual void Write(DataWriter& writer) = 0;
-
-	template<typename T>
-	static std::shared_ptr<T> Create();
-
-	static std::shared_ptr<Packet> CreateFromID(uint8_t type);
 };
 
+// Times on the server timeline are sent as microseconds since the server started, in 32 bits. They wrap around
+// every 71 minutes, so they are read relative to the time the receiver expects, see ClockSync.
+
 // The Welcome packet is the first packet sent, from the server to the client.
-// It informs the client of it's internal ID.
+// It informs the client of it's internal ID, and of the current tick and server time so the client can start out
+// roughly in step with the server before its clock is synchronized.
 struct WelcomePacket : public Packet
 {
+	static constexpr PacketType ID = PacketType::Welcome;
+
 	uint32_t ClientID = 0;
+	uint32_t Tick = 0;
+	uint32_t ServerTime = 0;
 
-	WelcomePacket()
-		: Packet(PacketType::Welcome)
-	{
-	}
+	// How many world states the server sends a second.
+	uint32_t SnapshotRate = 0;
 
-	void Read(DataReader& reader) override
-	{
-		ClientID = reader.Read<uint32_t>();
-	}
+	using Fields = Schema::Struct<
+		Schema::Field<&WelcomePacket::ClientID, Schema::Varint<>>,
+		Schema::Field<&WelcomePacket::Tick, Schema::Bits<32>>,
+		Schema::Field<&WelcomePacket::ServerTime, Schema::Bits<32>>,
+		Schema::Field<&WelcomePacket::SnapshotRate, Schema::Varint<>>
+	>;
 
-	void Write(DataWriter& writer) override
+	WelcomePacket()
+		: Packet(ID)
 	{
-		writer.Write<uint32_t>(ClientID);
 	}
 };
 
 // The Input packet is sent whenever the user supplies some input.
 // It is used by the server to calculate the position of the player.
+// Input packets are sent unreliably. Rather than waiting for a lost one to be resent, every packet carries the
+// most recent inputs the server has not acknowledged yet, so one which is lost is covered by the next.
+// The inputs are consecutive, so only the sequence number of the first is sent. Keyboard input rarely changes
+// from one frame to the next, so the directions are sent as runs of identical inputs. The delta time is sent in
+// fixed point, the first in full and the rest as the difference from the one before, as the frame rate is
+// usually steady. The client must round its delta time with RoundDeltaTime before using it, so that it
+// predicts exactly what the server applies.
 struct InputPacket : public Packet
 {
-	InputSnapshot Input;
+	static constexpr PacketType ID = PacketType::Input;
 
-	InputPacket()
-		: Packet(PacketType::Input)
+	// The most inputs a packet can carry.
+	static constexpr uint32_t MaxInputs = 128;
+
+	// Run lengths and delta time differences are usually tiny.
+	static constexpr uint32_t GroupBits = 4;
+
+	// The inputs, oldest first. Only the first InputCount are used.
+	std::array<InputSnapshot, MaxInputs> Inputs;
+	uint32_t InputCount = 0;
+
+	struct InputsCodec
 	{
-	}
+		static constexpr size_t MaxBits = 2 * Schema::Varint<>::MaxBits + MaxInputs *
+			(Schema::Varint<GroupBits>::MaxBits + 2 * Schema::Direction::MaxBits + Schema::SignedVarint<GroupBits>::MaxBits);
+
+		static void Write(BitWriter& writer, const InputPacket& packet)
+		{
+			writer.WriteVarint(packet.InputCount);
+			if (packet.InputCount == 0) { return; }
+
+			writer.WriteVarint(packet.Inputs[0].SequenceNumber);
+
+			for (uint32_t i = 0; i < packet.InputCount; )
+			{
+				const auto& input = packet.Inputs[i];
+
+				uint32_t length = 1;
+				while (i + length < packet.InputCount && packet.Inputs[i + length].DeltaX == input.DeltaX && packet.Inputs[i + length].DeltaY == input.DeltaY)
+				{
+					length++;
+				}
+
+				writer.WriteVarint(length - 1, GroupBits);
+				Schema::Direction::Write(writer, input.DeltaX);
+				Schema::Direction::Write(writer, input.DeltaY);
+				i += length;
+			}
+
+			int32_t previous = 0;
+			for (uint32_t i = 0; i < packet.InputCount; i++)
+			{
+				int32_t deltaTime = Quantize::ToFixed(packet.Inputs[i].DeltaTime, Config::InputTimeFractionBits);
+				if (i == 0) { writer.WriteVarint(static_cast<uint32_t>(deltaTime)); }
+				else { writer.WriteSignedVarint(deltaTime - previous, GroupBits); }
+				previous = deltaTime;
+			}
+		}
+
+		static void Read(BitReader& reader, InputPacket& packet)
+		{
+			packet.InputCount = reader.ReadVarint();
+			if (packet.InputCount > MaxInputs)
+			{
+				packet.InputCount = 0;
+				reader.MarkMalformed();
+			}
+			if (packet.InputCount == 0) { return; }
+
+			uint32_t sequence = reader.ReadVarint();
+
+			for (uint32_t i = 0; i < packet.InputCount && !reader.HasOverflowed(); )
+			{
+				uint32_t length = reader.ReadVarint(GroupBits) + 1;
+				if (length > packet.InputCount - i)
+				{
+					reader.MarkMalformed();
+					break;
+				}
+
+				float dx, dy;
+				Schema::Direction::Read(reader, dx);
+				Schema::Direction::Read(reader, dy);
+				for (uint32_t end = i + length; i < end; i++)
+				{
+					packet.Inputs[i] = InputSnapshot(sequence + i, 0.0f, dx, dy);
+				}
+			}
+
+			int32_t deltaTime = 0;
+			for (uint32_t i = 0; i < packet.InputCount && !reader.HasOverflowed(); i++)
+			{
+				deltaTime = i == 0 ? static_cast<int32_t>(reader.ReadVarint()) : deltaTime + reader.ReadSignedVarint(GroupBits);
+				packet.Inputs[i].DeltaTime = Quantize::FromFixed(deltaTime, Config::InputTimeFractionBits);
+			}
+		}
+	};
 
-	void Read(DataReader& reader) override
+	using Fields = Schema::Struct<
+		Schema::Object<InputsCodec>
+	>;
+
+	InputPacket()
+		: Packet(ID)
 	{
-		Input.DeltaX = reader.Read<float>();
-		Input.DeltaY = reader.Read<float>();
-		Input.SequenceNumber = reader.Read<uint32_t>();
-		Input.DeltaTime = reader.Read<float>();
 	}
 
-	void Write(DataWriter& writer) override
+	static float RoundDeltaTime(float dt)
 	{
-		writer.Write<float>(Input.DeltaX);
-		writer.Write<float>(Input.DeltaY);
-		writer.Write<uint32_t>(Input.SequenceNumber);
-		writer.Write<float>(Input.DeltaTime);
+		return Quantize::Round(dt, Config::InputTimeFractionBits);
 	}
 };
 
 // The World State packet is sent to all the clients to inform them of the
 // new positions of the entities in the world.
+// It is delta compressed against a baseline, a previous world state which the
+// client has acknowledged. Only the entities which have changed since the baseline
+// are sent, and of those only the fields which have changed. A world state with
+// no baseline is a keyframe and contains every entity in full.
+// Positions are sent in fixed point, and every field is sent as the difference from
+// the same entity in the baseline, or from zero if the entity is new. Entity IDs are
+// sent as the gap from the previous ID, as they are sorted.
+// The server can also send the velocity of each entity, so the client can follow
+// the curve between positions rather than a straight line. Velocity only changes when
+// an entity turns, speeds up or slows down, so it costs little once delta compressed.
 struct WorldStatePacket : public Packet
 {
+	static constexpr PacketType ID = PacketType::WorldState;
+
 	struct Entry
 	{
 		uint32_t EntityID;
 		uint32_t PreviousInput;
 		float X;
 		float Y;
+		float VelocityX = 0.0f;
+		float VelocityY = 0.0f;
+	};
+
+	// Bits of the change mask, saying which fields of an entry were written.
+	enum ChangeMask : uint8_t
+	{
+		ChangedPreviousInput = 1 << 0,
+		ChangedX = 1 << 1,
+		ChangedY = 1 << 2,
+		ChangedVelocityX = 1 << 3,
+		ChangedVelocityY = 1 << 4,
+		ChangedAll = ChangedPreviousInput | ChangedX | ChangedY | ChangedVelocityX | ChangedVelocityY
 	};
 
-	std::vector<Entry> Entries;
+	static constexpr uint32_t ChangeMaskBits = 5;
 
-	WorldStatePacket()
-		: Packet(PacketType::WorldState)
+	// Most of the values in a world state are small differences, so they are written as varints with small groups.
+	static constexpr uint32_t GroupBits = 4;
+
+	// The fields of an entity which have changed, relative to the baseline. Positions and velocities are fixed point.
+	struct Change
+	{
+		uint32_t EntityID;
+		uint8_t Mask;
+		int32_t PreviousInput;
+		int32_t X;
+		int32_t Y;
+		int32_t VelocityX = 0;
+		int32_t VelocityY = 0;
+	};
+
+	static constexpr uint32_t NoBaseline = ~0u;
+
+	// The sequence number is the tick the world state was taken on, and the server time is when that tick was due.
+	uint32_t Sequence = 0;
+	uint32_t ServerTime = 0;
+	uint32_t BaselineSequence = NoBaseline;
+
+	// Whether the entities velocities are filled in. If not they are left at zero.
+	bool HasVelocity = false;
+
+	// Entities which are new or have changed since the baseline, and those which
+	// have been removed. Both are sorted by entity ID.
+	std::vector<Change> Changes;
+	std::vector<uint32_t> Removed;
+
+	// Reads the change following the one with the given ID, which is ignored for the first change.
+	static void ReadChange(BitReader& reader, bool first, uint32_t previousID, Change& change)
 	{
+		uint32_t gap = reader.ReadVarint(GroupBits);
+		change.EntityID = first ? gap : previousID + gap + 1;
+
+		// IDs only ever go up, anything which wraps around is malformed.
+		if (!first && change.EntityID <= previousID) { reader.MarkMalformed(); }
+
+		change.Mask = static_cast<uint8_t>(reader.ReadBits(ChangeMaskBits));
+		change.PreviousInput = change.Mask & ChangedPreviousInput ? reader.ReadSignedVarint(GroupBits) : 0;
+		change.X = change.Mask & ChangedX ? reader.ReadSignedVarint(GroupBits) : 0;
+		change.Y = change.Mask & ChangedY ? reader.ReadSignedVarint(GroupBits) : 0;
+		change.VelocityX = change.Mask & ChangedVelocityX ? reader.ReadSignedVarint(GroupBits) : 0;
+		change.VelocityY = change.Mask & ChangedVelocityY ? reader.ReadSignedVarint(GroupBits) : 0;
 	}
 
-	void Read(DataReader& reader) override
+	// Reads the changes of a world state one at a time, straight out of the buffer it was received in.
+	class ChangeReader
 	{
-		uint32_t count = reader.Read<uint32_t>();
-		for (int i = 0; i < count; i++)
+	private:
+		BitReader m_Reader;
+		uint32_t m_Remaining = 0;
+		uint32_t m_PreviousID = 0;
+		bool m_First = true;
+	public:
+		ChangeReader()
+			: m_Reader(nullptr, 0)
 		{
-			WorldStatePacket::Entry entry;
-			entry.EntityID = reader.Read<uint32_t>();
-			entry.PreviousInput = reader.Read<uint32_t>();
-			entry.X = reader.Read<float>();
-			entry.Y = reader.Read<float>();
-			Entries.push_back(entry);
 		}
-	}
 
-	void Write(DataWriter& writer) override
+		// Takes a copy of a reader which is positioned at the start of the changes.
+		explicit ChangeReader(const BitReader& reader)
+			: m_Reader(reader)
+		{
+			m_Remaining = m_Reader.ReadVarint();
+		}
+
+		// Reads the next change. Returns false once there are none left, or if the data turns out to be malformed.
+		bool Next(Change& change)
+		{
+			if (m_Remaining == 0 || m_Reader.HasOverflowed()) { return false; }
+
+			ReadChange(m_Reader, m_First, m_PreviousID, change);
+			if (m_Reader.HasOverflowed()) { return false; }
+
+			m_PreviousID = change.EntityID;
+			m_First = false;
+			m_Remaining--;
+			return true;
+		}
+
+		// Returns true if the changes ran past the end of the buffer or were malformed, only final once Next has returned false.
+		bool HasOverflowed() const { return m_Reader.HasOverflowed(); }
+	};
+
+	// The baseline is sent as how far behind this world state it is, zero meaning there is none.
+	struct BaselineCodec
 	{
-		writer.Write<uint32_t>(Entries.size());
-		for (const auto& entry : Entries)
+		static constexpr size_t MaxBits = Schema::Varint<GroupBits>::MaxBits;
+
+		template<typename T>
+		static void Write(BitWriter& writer, const T& packet)
 		{
-			writer.Write<uint32_t>(entry.EntityID);
-			writer.Write<uint32_t>(entry.PreviousInput);
-			writer.Write<float>(entry.X);
-			writer.Write<float>(entry.Y);
+			writer.WriteVarint(packet.IsKeyframe() ? 0 : packet.Sequence - packet.BaselineSequence, GroupBits);
 		}
+
+		template<typename T>
+		static void Read(BitReader& reader, T& packet)
+		{
+			uint32_t offset = reader.ReadVarint(GroupBits);
+			packet.BaselineSequence = offset != 0 ? packet.Sequence - offset : NoBaseline;
+		}
+	};
+
+	// Each change is written as the gap from the previous entity ID, then the mask, then only the fields in the mask.
+	// The changes come last, so they can be read in place, see WorldStateView.
+	struct ChangesCodec
+	{
+		static constexpr size_t MaxBits = Schema::Unbounded;
+
+		static void Write(BitWriter& writer, const std::vector<Change>& changes)
+		{
+			writer.WriteVarint(static_cast<uint32_t>(changes.size()));
+			for (size_t i = 0; i < changes.size(); i++)
+			{
+				const auto& change = changes[i];
+				writer.WriteVarint(i > 0 ? change.EntityID - changes[i - 1].EntityID - 1 : change.EntityID, GroupBits);
+				writer.WriteBits(change.Mask, ChangeMaskBits);
+				if (change.Mask & ChangedPreviousInput) { writer.WriteSignedVarint(change.PreviousInput, GroupBits); }
+				if (change.Mask & ChangedX) { writer.WriteSignedVarint(change.X, GroupBits); }
+				if (change.Mask & ChangedY) { writer.WriteSignedVarint(change.Y, GroupBits); }
+				if (change.Mask & ChangedVelocityX) { writer.WriteSignedVarint(change.VelocityX, GroupBits); }
+				if (change.Mask & ChangedVelocityY) { writer.WriteSignedVarint(change.VelocityY, GroupBits); }
+			}
+		}
+
+		static void Read(BitReader& reader, std::vector<Change>& changes)
+		{
+			changes.clear();
+
+			uint32_t count = reader.ReadVarint();
+			for (uint32_t i = 0; i < count && !reader.HasOverflowed(); i++)
+			{
+				Change change;
+				ReadChange(reader, i == 0, i > 0 ? changes.back().EntityID : 0, change);
+				changes.push_back(change);
+			}
+		}
+	};
+
+	using Fields = Schema::Struct<
+		Schema::Field<&WorldStatePacket::Sequence, Schema::Bits<32>>,
+		Schema::Field<&WorldStatePacket::ServerTime, Schema::Bits<32>>,
+		Schema::Field<&WorldStatePacket::HasVelocity, Schema::Bits<1>>,
+		Schema::Object<BaselineCodec>,
+		Schema::Field<&WorldStatePacket::Removed, Schema::SortedIDs<GroupBits>>,
+		Schema::Field<&WorldStatePacket::Changes, ChangesCodec>
+	>;
+
+	WorldStatePacket()
+		: Packet(ID)
+	{
 	}
+
+	bool IsKeyframe() const { return BaselineSequence == NoBaseline; }
 };
 
-template<typename T>
-inline std::shared_ptr<T> Packet::Create() { return std::make_shared<T>(); }
+// A received world state, read without copying its changes out of the buffer it arrived in. The header and the
+// removed entities are read up front, the changes are read one at a time through Changes, and are only checked
+// as they are read. The view is only valid while the buffer is, and must be thrown away if Changes turns out to
+// have overflowed.
+struct WorldStateView : public Packet
+{
+	static constexpr PacketType ID = PacketType::WorldState;
+
+	using Change = WorldStatePacket::Change;
+	using ChangeReader = WorldStatePacket::ChangeReader;
+
+	// Stands in for WorldStatePacket::ChangesCodec, handing out a reader positioned at the changes.
+	struct ChangesCodec
+	{
+		static constexpr size_t MaxBits = Schema::Unbounded;
+
+		static void Read(BitReader& reader, ChangeReader& changes) { changes = ChangeReader(reader); }
+	};
+
+	uint32_t Sequence = 0;
+	uint32_t ServerTime = 0;
+	uint32_t BaselineSequence = WorldStatePacket::NoBaseline;
+	bool HasVelocity = false;
+	std::vector<uint32_t> Removed;
+	ChangeReader Changes;
+
+	using Fields = Schema::Struct<
+		Schema::Field<&WorldStateView::Sequence, Schema::Bits<32>>,
+		Schema::Field<&WorldStateView::ServerTime, Schema::Bits<32>>,
+		Schema::Field<&WorldStateView::HasVelocity, Schema::Bits<1>>,
+		Schema::Object<WorldStatePacket::BaselineCodec>,
+		Schema::Field<&WorldStateView::Removed, Schema::SortedIDs<WorldStatePacket::GroupBits>>,
+		Schema::Field<&WorldStateView::Changes, ChangesCodec>
+	>;
+
+	WorldStateView()
+		: Packet(ID)
+	{
+	}
+
+	bool IsKeyframe() const { return BaselineSequence == WorldStatePacket::NoBaseline; }
+};
+
+// The Snapshot Ack packet is sent by the client whenever it receives a world
+// state, so the server knows which world states it can use as a baseline.
+struct SnapshotAckPacket : public Packet
+{
+	static constexpr PacketType ID = PacketType::SnapshotAck;
+
+	uint32_t Sequence = 0;
+
+	using Fields = Schema::Struct<
+		Schema::Field<&SnapshotAckPacket::Sequence, Schema::Bits<32>>
+	>;
+
+	SnapshotAckPacket()
+		: Packet(ID)
+	{
+	}
+};
+
+// The Ping packet is sent by the client every so often to synchronize its clock with the server. The server
+// answers straight away with a Pong, which echoes the clients time and says when the ping was received and when
+// the pong was sent on the server timeline. Client times are microseconds on the clients own clock, in 32 bits.
+struct PingPacket : public Packet
+{
+	static constexpr PacketType ID = PacketType::Ping;
+
+	uint32_t ClientTime = 0;
+
+	using Fields = Schema::Struct<
+		Schema::Field<&PingPacket::ClientTime, Schema::Bits<32>>
+	>;
+
+	PingPacket()
+		: Packet(ID)
+	{
+	}
+};
 
-inline std::shared_ptr<Packet> Packet::CreateFromID(uint8_t id)
+struct PongPacket : public Packet
 {
-	PacketType type = static_cast<PacketType>(id);
+	static constexpr PacketType ID = PacketType::Pong;
+
+	uint32_t ClientTime = 0;
+	uint32_t ReceiveTime = 0;
+	uint32_t SendTime = 0;
 
-	switch (type)
+	using Fields = Schema::Struct<
+		Schema::Field<&PongPacket::ClientTime, Schema::Bits<32>>,
+		Schema::Field<&PongPacket::ReceiveTime, Schema::Bits<32>>,
+		Schema::Field<&PongPacket::SendTime, Schema::Bits<32>>
+	>;
+
+	PongPacket()
+		: Packet(ID)
 	{
-	case PacketType::Welcome: return std::make_shared<WelcomePacket>();
-	case PacketType::Input: return std::make_shared<InputPacket>();
-	case PacketType::WorldState: return std::make_shared<WorldStatePacket>();
-	default: assert(!"Unknown packet ID!");
 	}
+};
+
+// The most bytes a packet of the given type can take up including its type, or Schema::Unbounded.
+template<typename T>
+constexpr size_t MaxPacketSize = T::Fields::IsBounded ? 1 + T::Fields::MaxSize : Schema::Unbounded;
+
+// Writes a packet, starting with its type.
+template<typename T>
+inline void WritePacket(BitWriter& writer, const T& packet)
+{
+	writer.WriteBits(static_cast<uint8_t>(T::ID), 8);
+	T::Fields::Write(writer, packet);
 }
+
+// Decodes received packets and hands them to a handler as their concrete type, accepting only the listed types.
+// Each type is decoded into an instance kept by the decoder, so once their vectors have grown to fit decoding a
+// packet does not allocate, and dispatching it needs no casts.
+template<typename... Types>
+class PacketDecoder
+{
+private:
+	std::tuple<Types...> m_Packets;
+public:
+	// Reads a packet, starting with its type, and calls handler(packet) with it.
+	// Returns false without calling the handler if the type is not one of those listed, or the packet was cut short.
+	template<typename Handler>
+	bool Decode(BitReader& reader, Handler&& handler)
+	{
+		uint8_t type = static_cast<uint8_t>(reader.ReadBits(8));
+		if (reader.HasOverflowed()) { return false; }
+
+		bool handled = false;
+		((type == static_cast<uint8_t>(Types::ID) && (handled = Decode<Types>(reader, handler), true)) || ...);
+		return handled;
+	}
+private:
+	template<typename T, typename Handler>
+	bool Decode(BitReader& reader, Handler& handler)
+	{
+		T& packet = std::get<T>(m_Packets);
+		T::Fields::Read(reader, packet);
+		if (reader.HasOverflowed()) { return false; }
+
+		handler(static_cast<const T&>(packet));
+		return true;
+	}
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+#include <enet.h>
+
+#include "Packet.h"
+#include "BitWriter.h"
+#include "SpscQueue.h"
+
+// Encodes packets straight into pooled buffers which are handed to ENet without being copied.
+//
+// Buffers come in power of two size classes and are recycled through a free list per class, so once the pool
+// has warmed up encoding a packet does not allocate any buffer memory. Each packet is first written into the size
+// class the last packet of the same type fitted in, and only moves up a class if it does not fit.
+//
+// The pool belongs to the thread which encodes packets, but ENet frees packets on whichever thread services the
+// host. Buffers freed on the owning thread go straight back on the free lists, those freed on any other thread are
+// passed back through a queue. Only one other thread may free packets at a time.
+class PacketPool
+{
+public:
+	static constexpr size_t MinBufferSize = 64;
+	static constexpr size_t SizeClassCount = 16;
+	static constexpr size_t MaxBufferSize = MinBufferSize << (SizeClassCount - 1);
+private:
+	// Stored at the start of every buffer, so a buffer can be put back on the right free list.
+	struct BufferHeader
+	{
+		PacketPool* Pool;
+		uint32_t SizeClass;
+	};
+
+	static constexpr size_t HeaderSize = (sizeof(BufferHeader) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+	std::array<std::vector<uint8_t*>, SizeClassCount> m_FreeBuffers;
+	std::array<uint8_t, 256> m_SizeHints = {};
+	SpscQueue<uint8_t*, 4096> m_ReturnedBuffers;
+
+	// The thread which encodes packets, set by the first call to Encode.
+	std::atomic<std::thread::id> m_Owner;
+public:
+	PacketPool() = default;
+	PacketPool(const PacketPool&) = delete;
+	PacketPool& operator=(const PacketPool&) = delete;
+
+	// Every packet from the pool must have been freed before the pool is destroyed.
+	~PacketPool()
+	{
+		CollectReturnedBuffers();
+		for (auto& buffers : m_FreeBuffers)
+		{
+			for (uint8_t* buffer : buffers)
+			{
+				delete[] buffer;
+			}
+		}
+	}
+
+	// Encodes a packet, including its type, into an ENet packet with the given flags.
+	// Returns nullptr if the packet does not fit in the largest buffer.
+	template<typename T>
+	ENetPacket* Encode(const T& packet, uint32_t flags)
+	{
+		if (m_Owner.load(std::memory_order_relaxed) == std::thread::id())
+		{
+			m_Owner.store(std::this_thread::get_id(), std::memory_order_relaxed);
+		}
+		assert(m_Owner.load(std::memory_order_relaxed) == std::this_thread::get_id() && "Packets must be encoded on the thread which owns the pool!");
+
+		CollectReturnedBuffers();
+
+		// Packets with a bounded size always fit in the size class picked here, the rest start from the size
+		// class the last packet of the same type fitted in.
+		uint8_t type = static_cast<uint8_t>(T::ID);
+		constexpr uint32_t fixedSizeClass = GetSizeClass(MaxPacketSize<T>);
+		for (uint32_t sizeClass = fixedSizeClass < SizeClassCount ? fixedSizeClass : m_SizeHints[type]; sizeClass < SizeClassCount; sizeClass++)
+		{
+			uint8_t* buffer = Acquire(sizeClass);
+			uint8_t* data = buffer + HeaderSize;
+
+			BitWriter writer(data, GetBufferSize(sizeClass));
+			WritePacket(writer, packet);
+
+			size_t size = writer.GetSize();
+			if (writer.HasOverflowed())
+			{
+				Release(buffer);
+				continue;
+			}
+
+			ENetPacket* result = enet_packet_create(data, size, flags | ENET_PACKET_FLAG_NO_ALLOCATE);
+			if (result == nullptr)
+			{
+				Release(buffer);
+				return nullptr;
+			}
+
+			result->freeCallback = &FreePacket;
+			m_SizeHints[type] = static_cast<uint8_t>(sizeClass);
+			return result;
+		}
+
+		return nullptr;
+	}
+private:
+	static constexpr size_t GetBufferSize(uint32_t sizeClass) { return MinBufferSize << sizeClass; }
+
+	// Returns the smallest size class a buffer of the given size fits in, or SizeClassCount if there is none.
+	static constexpr uint32_t GetSizeClass(size_t size)
+	{
+		uint32_t sizeClass = 0;
+		while (sizeClass < SizeClassCount && GetBufferSize(sizeClass) < size) { sizeClass++; }
+		return sizeClass;
+	}
+
+	uint8_t* Acquire(uint32_t sizeClass)
+	{
+		auto& buffers = m_FreeBuffers[sizeClass];
+		if (!buffers.empty())
+		{
+			uint8_t* buffer = buffers.back();
+			buffers.pop_back();
+			return buffer;
+		}
+
+		uint8_t* buffer = new uint8_t[HeaderSize + GetBufferSize(sizeClass)];
+		auto header = reinterpret_cast<BufferHeader*>(buffer);
+		header->Pool = this;
+		header->SizeClass = sizeClass;
+		return buffer;
+	}
+
+	void Release(uint8_t* buffer)
+	{
+		auto header = reinterpret_cast<BufferHeader*>(buffer);
+		m_FreeBuffers[header->SizeClass].push_back(buffer);
+	}
+
+	void CollectReturnedBuffers()
+	{
+		uint8_t* buffer;
+		while (m_ReturnedBuffers.Pop(buffer))
+		{
+			Release(buffer);
+		}
+	}
+
+	// Called by ENet when it is done with a packet.
+	static void FreePacket(void* p)
+	{
+		auto packet = static_cast<ENetPacket*>(p);
+		uint8_t* buffer = packet->data - HeaderSize;
+		PacketPool* pool = reinterpret_cast<BufferHeader*>(buffer)->Pool;
+
+		if (std::this_thread::get_id() == pool->m_Owner.load(std::memory_order_relaxed))
+		{
+			pool->Release(buffer);
+		}
+		else if (!pool->m_ReturnedBuffers.Push(buffer))
+		{
+			// The owner has fallen behind on collecting buffers, it will allocate a new one when it needs to.
+			delete[] buffer;
+		}
+	}
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+// Helpers for squeezing values down before they are sent over the network.
+namespace Quantize
+{
+	// Maps signed integers onto unsigned ones so that values close to zero stay small, 0, -1, 1, -2, 2 and so on
+	// become 0, 1, 2, 3, 4.
+	inline uint32_t ZigZagEncode(int32_t value)
+	{
+		return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+	}
+
+	inline int32_t ZigZagDecode(uint32_t value)
+	{
+		return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+	}
+
+	// Converts a value to a fixed point number with the given number of fractional bits, rounding to the nearest.
+	// The scale is a power of two, so converting back gives exactly the value the other side of the connection
+	// will see, and converting that again gives the same fixed point number.
+	inline int32_t ToFixed(float value, uint32_t fractionBits)
+	{
+		return static_cast<int32_t>(std::lround(value * static_cast<float>(1u << fractionBits)));
+	}
+
+	inline float FromFixed(int32_t value, uint32_t fractionBits)
+	{
+		return static_cast<float>(value) / static_cast<float>(1u << fractionBits);
+	}
+
+	// Rounds a value to the nearest one which can be represented with the given number of fractional bits.
+	inline float Round(float value, uint32_t fractionBits)
+	{
+		return FromFixed(ToFixed(value, fractionBits), fractionBits);
+	}
+}
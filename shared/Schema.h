@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "BitReader.h"
+#include "BitWriter.h"
+
+// Describes the wire format of a packet as a list of fields, each of which names a member and the codec used to
+// write it. The encoder and decoder are generated from the list at compile time, so a packet is written by
+// straight-line code in the order the fields are listed, with no virtual calls.
+//
+// Every codec knows the most bits it can ever take up, so the largest encoded size of a packet made up only of
+// bounded fields is known at compile time.
+//
+//     using Fields = Schema::Struct<
+//         Schema::Field<&InputSnapshot::SequenceNumber, Schema::Varint<>>,
+//         Schema::Field<&InputSnapshot::DeltaX, Schema::Direction>>;
+//
+//     Fields::Write(writer, input);
+//
+// Reading overwrites every field, so the same object can be read into again and again.
+namespace Schema
+{
+	// The size of anything which can grow without limit, such as an array.
+	static constexpr size_t Unbounded = SIZE_MAX;
+
+	constexpr size_t AddBits(size_t a, size_t b)
+	{
+		return a == Unbounded || b == Unbounded ? Unbounded : a + b;
+	}
+
+	// An unsigned value written as a fixed number of bits.
+	template<uint32_t N>
+	struct Bits
+	{
+		static constexpr size_t MaxBits = N;
+
+		template<typename T>
+		static void Write(BitWriter& writer, const T& value) { writer.WriteBits(static_cast<uint32_t>(value), N); }
+
+		template<typename T>
+		static void Read(BitReader& reader, T& value) { value = static_cast<T>(reader.ReadBits(N)); }
+	};
+
+	// An unsigned integer written as a varint, see BitWriter::WriteVarint.
+	template<uint32_t GroupBits = 7>
+	struct Varint
+	{
+		static constexpr size_t MaxBits = ((32 + GroupBits - 1) / GroupBits) * (GroupBits + 1);
+
+		static void Write(BitWriter& writer, uint32_t value) { writer.WriteVarint(value, GroupBits); }
+		static void Read(BitReader& reader, uint32_t& value) { value = reader.ReadVarint(GroupBits); }
+	};
+
+	// A signed integer written as a zigzag varint.
+	template<uint32_t GroupBits = 7>
+	struct SignedVarint
+	{
+		static constexpr size_t MaxBits = Varint<GroupBits>::MaxBits;
+
+		static void Write(BitWriter& writer, int32_t value) { writer.WriteSignedVarint(value, GroupBits); }
+		static void Read(BitReader& reader, int32_t& value) { value = reader.ReadSignedVarint(GroupBits); }
+	};
+
+	// A movement axis. Keyboard input only ever moves a whole step one way or the other, which is sent as two bits.
+	// Anything else falls back to a full float, so the server still gets to see and reject it.
+	struct Direction
+	{
+		static constexpr size_t MaxBits = 1 + 32;
+
+		static void Write(BitWriter& writer, float value)
+		{
+			bool isStep = value == -1.0f || value == 0.0f || value == 1.0f;
+			writer.WriteBool(isStep);
+			if (isStep)
+			{
+				writer.WriteBits(static_cast<uint32_t>(value + 1.0f), 2);
+			}
+			else
+			{
+				writer.WriteFloat(value);
+			}
+		}
+
+		static void Read(BitReader& reader, float& value)
+		{
+			value = reader.ReadBool() ? static_cast<float>(reader.ReadBits(2)) - 1.0f : reader.ReadFloat();
+		}
+	};
+
+	// A sorted list of IDs, written as the gaps between them.
+	template<uint32_t GroupBits = 7>
+	struct SortedIDs
+	{
+		static constexpr size_t MaxBits = Unbounded;
+
+		static void Write(BitWriter& writer, const std::vector<uint32_t>& ids)
+		{
+			writer.WriteVarint(static_cast<uint32_t>(ids.size()));
+			for (size_t i = 0; i < ids.size(); i++)
+			{
+				writer.WriteVarint(i > 0 ? ids[i] - ids[i - 1] - 1 : ids[i], GroupBits);
+			}
+		}
+
+		static void Read(BitReader& reader, std::vector<uint32_t>& ids)
+		{
+			ids.clear();
+
+			uint32_t count = reader.ReadVarint();
+			uint32_t id = 0;
+			for (uint32_t i = 0; i < count && !reader.HasOverflowed(); i++)
+			{
+				uint32_t previous = id;
+				id += reader.ReadVarint(GroupBits) + (i > 0 ? 1 : 0);
+
+				// IDs only ever go up, anything which wraps around is malformed.
+				if (i > 0 && id <= previous) { reader.MarkMalformed(); }
+				ids.push_back(id);
+			}
+		}
+	};
+
+	// Binds a member to the codec it is written with.
+	template<auto Member, typename Codec>
+	struct Field
+	{
+		static constexpr size_t MaxBits = Codec::MaxBits;
+
+		template<typename T>
+		static void Write(BitWriter& writer, const T& object) { Codec::Write(writer, object.*Member); }
+
+		template<typename T>
+		static void Read(BitReader& reader, T& object) { Codec::Read(reader, object.*Member); }
+	};
+
+	// Hands the whole object to a codec, for values which depend on more than one member.
+	template<typename Codec>
+	struct Object
+	{
+		static constexpr size_t MaxBits = Codec::MaxBits;
+
+		template<typename T>
+		static void Write(BitWriter& writer, const T& object) { Codec::Write(writer, object); }
+
+		template<typename T>
+		static void Read(BitReader& reader, T& object) { Codec::Read(reader, object); }
+	};
+
+	// A list of fields written one after the other. Can also be used as the codec of a field, for nested structs.
+	template<typename... Fields>
+	struct Struct
+	{
+		static constexpr size_t MaxBits = [] { size_t bits = 0; ((bits = AddBits(bits, Fields::MaxBits)), ...); return bits; }();
+		static constexpr bool IsBounded = MaxBits != Unbounded;
+
+		// The most bytes the fields can take up, only meaningful if they are bounded.
+		static constexpr size_t MaxSize = IsBounded ? (MaxBits + 7) / 8 : Unbounded;
+
+		template<typename T>
+		static void Write(BitWriter& writer, const T& object) { (Fields::Write(writer, object), ...); }
+
+		template<typename T>
+		static void Read(BitReader& reader, T& object) { (Fields::Read(reader, object), ...); }
+	};
+}
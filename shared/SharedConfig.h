@@ -1,8 +1,24 @@
 #pragma once
 
+#include <cstdint>
+
 namespace Config
 {
 	static constexpr auto Port = 26456;
 	static constexpr auto ServerTimestep = 30;
-	static constexpr auto MaxClients = 32;
+	static constexpr auto DefaultMaxClients = 32;
+
+	// How often clients sample and send their input, each input covers one step of this length. Matching the
+	// server tick means each tick applies one input per client, however fast the client renders.
+	static constexpr auto InputRate = ServerTimestep;
+
+	// Positions are sent as fixed point numbers with this many fractional bits, 4 gives a precision of 1/16th of a pixel.
+	static constexpr uint32_t PositionFractionBits = 4;
+
+	// Velocities are sent the same way, in pixels per second. Whole pixels per second are off by less than 1/20th of
+	// a pixel over the gap between world states, even at 10 a second.
+	static constexpr uint32_t VelocityFractionBits = 0;
+
+	// Input delta times are sent as fixed point seconds with this many fractional bits, 13 gives roughly 0.12ms.
+	static constexpr uint32_t InputTimeFractionBits = 13;
 }
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include "Packet.h"
+#include "Quantize.h"
+#include "SharedConfig.h"
+
+// A full copy of the state of the world at a point in time, with the entries sorted by entity ID.
+struct Snapshot
+{
+	uint32_t Sequence = 0;
+	bool Valid = false;
+	std::vector<WorldStatePacket::Entry> Entries;
+};
+
+// Keeps the most recent snapshots around, so they can be used as baselines for delta compression.
+// Snapshots are recycled, so once the history has filled up storing a new one does not allocate.
+template<size_t Capacity>
+class SnapshotHistory
+{
+private:
+	std::array<Snapshot, Capacity> m_Snapshots;
+public:
+	// Returns an empty snapshot to be filled in, replacing the oldest one.
+	Snapshot& Push(uint32_t sequence)
+	{
+		auto& snapshot = m_Snapshots[sequence % Capacity];
+		snapshot.Sequence = sequence;
+		snapshot.Valid = true;
+		snapshot.Entries.clear();
+		return snapshot;
+	}
+
+	// Returns the snapshot with the given sequence number, or nullptr if it is no longer in the history.
+	const Snapshot* Find(uint32_t sequence) const
+	{
+		auto& snapshot = m_Snapshots[sequence % Capacity];
+		return snapshot.Valid && snapshot.Sequence == sequence ? &snapshot : nullptr;
+	}
+};
+
+// Returns true if sequence number a comes after b, taking wrap around into account.
+inline bool IsSequenceNewer(uint32_t a, uint32_t b)
+{
+	return static_cast<int32_t>(a - b) > 0;
+}
+
+// Positions are sent in fixed point.
+inline int32_t ToFixedPosition(float value) { return Quantize::ToFixed(value, Config::PositionFractionBits); }
+inline float FromFixedPosition(int32_t value) { return Quantize::FromFixed(value, Config::PositionFractionBits); }
+inline int32_t ToFixedVelocity(float value) { return Quantize::ToFixed(value, Config::VelocityFractionBits); }
+inline float FromFixedVelocity(int32_t value) { return Quantize::FromFixed(value, Config::VelocityFractionBits); }
+
+// Fills in a world state packet with the difference between a baseline and the current snapshot.
+// Passing a null baseline produces a keyframe.
+inline void EncodeDelta(const Snapshot* baseline, const Snapshot& current, WorldStatePacket& packet)
+{
+	using Entry = WorldStatePacket::Entry;
+
+	packet.Sequence = current.Sequence;
+	packet.BaselineSequence = baseline != nullptr ? baseline->Sequence : WorldStatePacket::NoBaseline;
+	packet.Changes.clear();
+	packet.Removed.clear();
+
+	static const std::vector<Entry> empty;
+	const auto& previous = baseline != nullptr ? baseline->Entries : empty;
+
+	// Both lists are sorted by entity ID, so we can walk them side by side.
+	size_t i = 0, j = 0;
+	while (i < current.Entries.size() || j < previous.size())
+	{
+		if (j == previous.size() || (i < current.Entries.size() && current.Entries[i].EntityID < previous[j].EntityID))
+		{
+			// A new entity, send it in full. Velocities default to zero, which is all they are when the server
+			// does not send them, so they are left out then.
+			const Entry& now = current.Entries[i];
+			WorldStatePacket::Change change = { now.EntityID, WorldStatePacket::ChangedAll, static_cast<int32_t>(now.PreviousInput), ToFixedPosition(now.X), ToFixedPosition(now.Y),
+				ToFixedVelocity(now.VelocityX), ToFixedVelocity(now.VelocityY) };
+			if (change.VelocityX == 0) { change.Mask &= ~WorldStatePacket::ChangedVelocityX; }
+			if (change.VelocityY == 0) { change.Mask &= ~WorldStatePacket::ChangedVelocityY; }
+			packet.Changes.push_back(change);
+			i++;
+		}
+		else if (i == current.Entries.size() || previous[j].EntityID < current.Entries[i].EntityID)
+		{
+			// The entity has gone away.
+			packet.Removed.push_back(previous[j].EntityID);
+			j++;
+		}
+		else
+		{
+			// The entity exists in both, send only what has changed. Positions are compared after quantizing, as
+			// that is all the client will see.
+			const Entry& now = current.Entries[i];
+			const Entry& then = previous[j];
+
+			WorldStatePacket::Change change = { now.EntityID, 0, 0, 0, 0 };
+			change.PreviousInput = static_cast<int32_t>(now.PreviousInput - then.PreviousInput);
+			change.X = ToFixedPosition(now.X) - ToFixedPosition(then.X);
+			change.Y = ToFixedPosition(now.Y) - ToFixedPosition(then.Y);
+			change.VelocityX = ToFixedVelocity(now.VelocityX) - ToFixedVelocity(then.VelocityX);
+			change.VelocityY = ToFixedVelocity(now.VelocityY) - ToFixedVelocity(then.VelocityY);
+
+			if (change.PreviousInput != 0) { change.Mask |= WorldStatePacket::ChangedPreviousInput; }
+			if (change.X != 0) { change.Mask |= WorldStatePacket::ChangedX; }
+			if (change.Y != 0) { change.Mask |= WorldStatePacket::ChangedY; }
+			if (change.VelocityX != 0) { change.Mask |= WorldStatePacket::ChangedVelocityX; }
+			if (change.VelocityY != 0) { change.Mask |= WorldStatePacket::ChangedVelocityY; }
+
+			if (change.Mask != 0)
+			{
+				packet.Changes.push_back(change);
+			}
+
+			i++;
+			j++;
+		}
+	}
+}
+
+// Rebuilds a full snapshot from a received world state and the baseline it was encoded against.
+// The baseline must be null for a keyframe. The changes are read as they are merged in, so this returns false if
+// they turn out to be malformed, in which case the result must be thrown away.
+inline bool ApplyDelta(const Snapshot* baseline, const WorldStateView& view, Snapshot& result)
+{
+	using Entry = WorldStatePacket::Entry;
+
+	static const std::vector<Entry> empty;
+	const auto& previous = baseline != nullptr ? baseline->Entries : empty;
+
+	result.Sequence = view.Sequence;
+	result.Valid = true;
+	result.Entries.clear();
+
+	auto changes = view.Changes;
+	WorldStateView::Change change;
+	bool hasChange = changes.Next(change);
+
+	size_t j = 0, k = 0;
+	while (hasChange || j < previous.size())
+	{
+		if (j == previous.size() || (hasChange && change.EntityID < previous[j].EntityID))
+		{
+			// A new entity, which is relative to zero.
+			result.Entries.push_back({ change.EntityID, static_cast<uint32_t>(change.PreviousInput), FromFixedPosition(change.X), FromFixedPosition(change.Y),
+				FromFixedVelocity(change.VelocityX), FromFixedVelocity(change.VelocityY) });
+			hasChange = changes.Next(change);
+		}
+		else if (!hasChange || previous[j].EntityID < change.EntityID)
+		{
+			// An entity which has either not changed, or has been removed.
+			while (k < view.Removed.size() && view.Removed[k] < previous[j].EntityID) { k++; }
+			if (k == view.Removed.size() || view.Removed[k] != previous[j].EntityID)
+			{
+				result.Entries.push_back(previous[j]);
+			}
+			j++;
+		}
+		else
+		{
+			// An entity which has changed, add on the fields which were sent and keep the rest.
+			Entry entry = previous[j];
+			if (change.Mask & WorldStatePacket::ChangedPreviousInput) { entry.PreviousInput += static_cast<uint32_t>(change.PreviousInput); }
+			if (change.Mask & WorldStatePacket::ChangedX) { entry.X = FromFixedPosition(ToFixedPosition(entry.X) + change.X); }
+			if (change.Mask & WorldStatePacket::ChangedY) { entry.Y = FromFixedPosition(ToFixedPosition(entry.Y) + change.Y); }
+			if (change.Mask & WorldStatePacket::ChangedVelocityX) { entry.VelocityX = FromFixedVelocity(ToFixedVelocity(entry.VelocityX) + change.VelocityX); }
+			if (change.Mask & WorldStatePacket::ChangedVelocityY) { entry.VelocityY = FromFixedVelocity(ToFixedVelocity(entry.VelocityY) + change.VelocityY); }
+			result.Entries.push_back(entry);
+			hasChange = changes.Next(change);
+			j++;
+		}
+	}
+
+	return !changes.HasOverflowed();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// A fixed capacity, lock-free queue for passing values from exactly one producer thread to exactly one
+// consumer thread. All storage lives inside the queue, so nothing is allocated after construction.
+template<typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two.");
+private:
+	static constexpr size_t Mask = Capacity - 1;
+
+	std::array<T, Capacity> m_Buffer;
+
+	// The head is only written by the consumer and the tail only by the producer. They are kept on separate
+	// cache lines so the two threads do not fight over the same line.
+	alignas(64) std::atomic<size_t> m_Head{ 0 };
+	alignas(64) std::atomic<size_t> m_Tail{ 0 };
+public:
+	// Adds a value to the back of the queue. Returns false if the queue is full.
+	// Must only be called from the producer thread.
+	bool Push(const T& value)
+	{
+		size_t tail = m_Tail.load(std::memory_order_relaxed);
+		if (tail - m_Head.load(std::memory_order_acquire) == Capacity) { return false; }
+
+		m_Buffer[tail & Mask] = value;
+		m_Tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Removes the value at the front of the queue. Returns false if the queue is empty.
+	// Must only be called from the consumer thread.
+	bool Pop(T& value)
+	{
+		size_t head = m_Head.load(std::memory_order_relaxed);
+		if (head == m_Tail.load(std::memory_order_acquire)) { return false; }
+
+		value = m_Buffer[head & Mask];
+		m_Head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+};
@@ -0,0 +1,265 @@
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "SharedConfig.h"
+#include "Entity.h"
+#include "Packet.h"
+#include "Snapshot.h"
+#include "PositionHistory.h"
+#include "InterpolationDelay.h"
+
+// Measures how far remote entities are drawn from where the server actually had them, at a range of world state
+// rates, when they are interpolated along straight lines and along Hermite curves.
+//
+// Entities are moved by the real EntityStore a tick at a time. World states are delta encoded, written and decoded
+// again the way the server and client do, and the positions which come out of them are drawn at 144 frames a second
+// through PositionHistory, as far behind as InterpolationDelay decides. Delivery is steady, each world state arrives
+// a tick and a bit after it was taken.
+//
+// Fails if Hermite interpolation is ever worse than straight lines below the full rate.
+
+static constexpr uint32_t EntityCount = 16;
+static constexpr double Duration = 60.0;
+static constexpr double FrameLength = 1.0 / 144.0;
+static constexpr double TickLength = 1.0 / Config::ServerTimestep;
+static constexpr double Latency = TickLength + 0.005;
+
+// Entities are only measured away from the start and the end, where there is nothing to interpolate between yet.
+static constexpr double Margin = 2.0;
+
+enum class Movement
+{
+	// Eight directions and standing still, changing every 0.2 to 1 seconds, as from a keyboard.
+	WASD,
+
+	// Always moving, turning one way or the other at a rate which changes every 0.5 to 1.5 seconds.
+	Steered
+};
+
+struct Error
+{
+	double Rms = 0.0;
+	double P99 = 0.0;
+	double BytesPerSecond = 0.0;
+
+	// The share of frames in which an entity was drawn past its newest position.
+	double Underruns = 0.0;
+};
+
+// Runs the server, and returns the world state of every tick.
+static std::vector<Snapshot> Simulate(Movement movement)
+{
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+	EntityStore entities;
+	for (uint32_t i = 0; i < EntityCount; i++)
+	{
+		entities.Add(uniform(rng) * 500.0f, uniform(rng) * 500.0f);
+	}
+
+	std::vector<float> directionX(EntityCount), directionY(EntityCount);
+	std::vector<float> angle(EntityCount, 0.0f), turnRate(EntityCount, 0.0f);
+	std::vector<double> nextChange(EntityCount, 0.0);
+
+	std::vector<Snapshot> ticks;
+	uint32_t tickCount = static_cast<uint32_t>(Duration * Config::ServerTimestep);
+	for (uint32_t tick = 0; tick < tickCount; tick++)
+	{
+		double time = tick * TickLength;
+		for (uint32_t i = 0; i < EntityCount; i++)
+		{
+			if (movement == Movement::WASD)
+			{
+				if (time >= nextChange[i])
+				{
+					uint32_t direction = rng() % 9;
+					float a = direction * 3.14159265f / 4.0f;
+					directionX[i] = direction == 8 ? 0.0f : std::cos(a);
+					directionY[i] = direction == 8 ? 0.0f : std::sin(a);
+					nextChange[i] = time + 0.2 + 0.8 * uniform(rng);
+				}
+			}
+			else
+			{
+				if (time >= nextChange[i])
+				{
+					turnRate[i] = (uniform(rng) * 2.0f - 1.0f) * 4.0f;
+					nextChange[i] = time + 0.5 + uniform(rng);
+				}
+				angle[i] += turnRate[i] * static_cast<float>(TickLength);
+				directionX[i] = std::cos(angle[i]);
+				directionY[i] = std::sin(angle[i]);
+			}
+			entities.QueueInput(i, InputSnapshot(tick + 1, static_cast<float>(TickLength), directionX[i], directionY[i]));
+		}
+		entities.Update(static_cast<float>(TickLength));
+
+		auto& snapshot = ticks.emplace_back();
+		snapshot.Sequence = tick;
+		snapshot.Valid = true;
+		for (uint32_t i = 0; i < EntityCount; i++)
+		{
+			snapshot.Entries.push_back({ i, entities.LastInput[i], entities.X[i], entities.Y[i], entities.VelocityX[i], entities.VelocityY[i] });
+		}
+	}
+	return ticks;
+}
+
+// Where the server had an entity at the given time. Entities move in a straight line over each tick.
+static void GetTruth(const std::vector<Snapshot>& ticks, uint32_t entity, double time, double& x, double& y)
+{
+	size_t tick = std::min(static_cast<size_t>(time / TickLength), ticks.size() - 2);
+	double t = time / TickLength - tick;
+	const auto& from = ticks[tick].Entries[entity];
+	const auto& to = ticks[tick + 1].Entries[entity];
+	x = from.X + (to.X - from.X) * t;
+	y = from.Y + (to.Y - from.Y) * t;
+}
+
+// The same ticks the server sends world states on, see IsSnapshotTick there.
+static bool IsSnapshotTick(uint64_t tick, uint32_t rate)
+{
+	return tick == 0 || (tick * rate) / Config::ServerTimestep != ((tick - 1) * rate) / Config::ServerTimestep;
+}
+
+static Error Measure(const std::vector<Snapshot>& ticks, uint32_t rate, bool sendVelocity)
+{
+	// Server side, the world states which have been sent.
+	Snapshot sent;
+	bool hasSent = false;
+	WorldStatePacket packet;
+	std::vector<uint8_t> buffer(16 * 1024);
+	size_t bytes = 0;
+
+	// Client side.
+	PacketDecoder<WorldStateView> decoder;
+	SnapshotHistory<32> received;
+	Snapshot decoded;
+	std::vector<PositionHistory> histories(EntityCount);
+
+	// The same as the client, see HandleWelcome there.
+	InterpolationDelay delay(InterpolationDelay::GetInterval(rate));
+	uint32_t frames = 0;
+	uint32_t underruns = 0;
+
+	std::vector<double> errors;
+	size_t nextTick = 0;
+	for (double time = 0.0; time < Duration - Margin; time += FrameLength)
+	{
+		// Send and receive every world state which has arrived by now.
+		for (; nextTick < ticks.size() && nextTick * TickLength + Latency <= time; nextTick++)
+		{
+			if (!IsSnapshotTick(nextTick, rate)) { continue; }
+
+			Snapshot current = ticks[nextTick];
+			if (!sendVelocity)
+			{
+				for (auto& entry : current.Entries) { entry.VelocityX = entry.VelocityY = 0.0f; }
+			}
+
+			EncodeDelta(hasSent ? &sent : nullptr, current, packet);
+			packet.HasVelocity = sendVelocity;
+			BitWriter writer(buffer.data(), buffer.size());
+			WritePacket(writer, packet);
+			bytes += writer.GetSize();
+			sent = current;
+			hasSent = true;
+
+			BitReader reader(buffer.data(), writer.GetSize());
+			bool decodedOk = decoder.Decode(reader, [&](const WorldStateView& view)
+			{
+				const Snapshot* baseline = view.IsKeyframe() ? nullptr : received.Find(view.BaselineSequence);
+				if (!ApplyDelta(baseline, view, decoded)) { return; }
+
+				delay.OnArrival(view.Sequence * TickLength, time);
+
+				auto& snapshot = received.Push(view.Sequence);
+				snapshot.Entries = decoded.Entries;
+				for (const auto& entry : snapshot.Entries)
+				{
+					EntityPosition position(view.Sequence * TickLength, entry.X, entry.Y);
+					if (view.HasVelocity) { position.SetVelocity(entry.VelocityX, entry.VelocityY); }
+					histories[entry.EntityID].Push(position);
+				}
+			});
+			if (!decodedOk || received.Find(current.Sequence) == nullptr)
+			{
+				std::cout << "World state " << current.Sequence << " could not be decoded." << std::endl;
+				std::exit(1);
+			}
+		}
+
+		double renderTime = time - delay.Update(static_cast<float>(FrameLength));
+		if (time < Margin) { continue; }
+
+		bool underrun = false;
+		for (uint32_t i = 0; i < EntityCount; i++)
+		{
+			float x, y;
+			underrun |= !histories[i].Sample(renderTime, x, y);
+
+			double truthX, truthY;
+			GetTruth(ticks, i, renderTime, truthX, truthY);
+			errors.push_back(std::hypot(x - truthX, y - truthY));
+		}
+
+		frames++;
+		if (underrun) { underruns++; }
+	}
+
+	Error result;
+	double sum = 0.0;
+	for (double error : errors) { sum += error * error; }
+	result.Rms = std::sqrt(sum / errors.size());
+
+	std::nth_element(errors.begin(), errors.begin() + errors.size() * 99 / 100, errors.end());
+	result.P99 = errors[errors.size() * 99 / 100];
+
+	result.BytesPerSecond = bytes / (Duration - Margin);
+	result.Underruns = static_cast<double>(underruns) / frames;
+	return result;
+}
+
+int main()
+{
+	bool passed = true;
+	std::cout << std::fixed;
+
+	for (Movement movement : { Movement::WASD, Movement::Steered })
+	{
+		auto ticks = Simulate(movement);
+
+		std::cout << (movement == Movement::WASD ? "WASD" : "Steered") << " movement, error in pixels as rms / p99, frames run dry" << std::endl;
+		std::cout << "  rate        linear          B/s       Hermite          B/s     dry" << std::endl;
+
+		for (uint32_t rate : { 30u, 20u, 15u, 10u })
+		{
+			Error linear = Measure(ticks, rate, false);
+			Error hermite = Measure(ticks, rate, true);
+
+			std::cout << std::setw(4) << rate << "Hz"
+				<< std::setprecision(3) << std::setw(9) << linear.Rms << " / " << std::setw(5) << linear.P99
+				<< std::setprecision(0) << std::setw(8) << linear.BytesPerSecond
+				<< std::setprecision(3) << std::setw(9) << hermite.Rms << " / " << std::setw(5) << hermite.P99
+				<< std::setprecision(0) << std::setw(8) << hermite.BytesPerSecond
+				<< std::setprecision(1) << std::setw(7) << hermite.Underruns * 100.0 << "%" << std::endl;
+
+			// At the full rate world states are a tick apart, there is nothing to curve and the server leaves the
+			// velocities out by default.
+			if (rate < Config::ServerTimestep && (hermite.Rms > linear.Rms || hermite.P99 > linear.P99))
+			{
+				std::cout << "FAILED: Hermite interpolation is worse than linear at " << rate << "Hz." << std::endl;
+				passed = false;
+			}
+		}
+		std::cout << std::endl;
+	}
+
+	return passed ? 0 : 1;
+}